@@ -0,0 +1,59 @@
+#ifndef BUDDHABROT_H_MATTONI
+#define BUDDHABROT_H_MATTONI
+
+/* Interface for orbit-density (Buddhabrot) rendering */
+
+#include <stdint.h>
+#include <complex.h>
+#include <pthread.h>
+
+#include "buffer.h"
+#include "mattoni_types.h"
+#include "render_ctx.h"
+
+enum buddhabrot_kind_t {
+    BUDDHABROT = 0,      // density of orbits that escape
+    ANTI_BUDDHABROT,     // density of orbits that never escape
+    NEBULABROT           // three escaping channels with different iteration limits, shown as RGB
+};
+
+/*
+ * Unlike the escape-time fractals, the work here scales with the number of sampled orbits rather
+ * than with the number of pixels. Every sampling task owns one histogram and is the only one
+ * writing to it, so no atomics are needed; the histograms are then summed by a parallel reduction
+ * and tone-mapped into buf. Samples accumulate over successive passes, so buf can be shown after
+ * each pass while the image sharpens.
+ *
+ * The tasks run on a render engine's threads at the given priority. The histograms are allocated
+ * once and cleared by buddhabrot_reset when the viewport changes.
+ */
+struct buddhabrot_t {
+    int kind;
+    ld_complex_t top;
+    ld_complex_t bottom;
+    size_t width;
+    size_t height;
+    unsigned int channels;
+    unsigned int tasks;
+    unsigned long passes;
+    unsigned long samples;
+
+    uint32_t **histograms;   // one per sampling task, channels * width * height counts each
+    uint32_t *total;         // sum of all histograms
+    uint32_t *band_max;      // per reduction band and channel, the largest total count
+    struct buffer_t *buf;    // tone-mapped image
+
+    struct render_engine_t *engine;
+    int priority;            // may be changed between passes
+    unsigned int pending;    // tasks of the current stage still running, guarded by lock
+    pthread_mutex_t lock;
+    pthread_cond_t stage_done;
+};
+
+struct buddhabrot_t *make_buddhabrot(struct render_engine_t *engine, int kind, ld_complex_t top,
+                                     ld_complex_t bottom, size_t width, size_t height);
+void buddhabrot_reset(struct buddhabrot_t *bb, ld_complex_t top, ld_complex_t bottom);
+void buddhabrot_pass(struct buddhabrot_t *bb, unsigned long samples);
+void free_buddhabrot(struct buddhabrot_t **bb);
+
+#endif // BUDDHABROT_H_MATTONI
@@ -0,0 +1,13 @@
+#ifndef FORMULA_H_MATTONI
+#define FORMULA_H_MATTONI
+
+/* Interface for compiling user-defined iteration formulas into native kernels */
+
+/*
+ * Compiles an iteration formula such as "z^3 + c*sin(z)" into an escape-time kernel and registers
+ * it next to the built-in fractals. Returns its which_fractal index, or -1 (after printing why)
+ * if the formula doesn't parse or can't be compiled.
+ */
+int compile_formula(const char *formula);
+
+#endif // FORMULA_H_MATTONI
@@ -1,3 +1,6 @@
+#ifndef FRACTAL_H_MATTONI
+#define FRACTAL_H_MATTONI
+
 /* Interface for fractal generation driver */
 
 #include <complex.h>
@@ -6,4 +9,26 @@
 #include "buffer.h"
 #include "mattoni_types.h"
 
-void fractal(ld_complex_t top, ld_complex_t bottom, int which_fractal, unsigned int seed, struct buffer_t *buf);
+#define MAX_ITERATIONS 400
+
+// Entries of the fractal_types table that are built in; more can be registered at runtime, up to
+// MAX_FRACTALS. which_fractal must be below fractal_count().
+#define NUM_BUILTIN_FRACTALS 5
+#define MAX_FRACTALS 64
+
+// Symmetries of a fractal that map the pixels it computes onto each other exactly.
+enum fractal_symmetry_t {
+    SYMMETRY_NONE = 0,
+    SYMMETRY_CONJUGATE,  // mirror image about the real axis
+    SYMMETRY_ROTATION    // half turn around the origin
+};
+
+typedef void (*fractal_fn)(ld_complex_t, ld_complex_t, unsigned int, struct buffer_t *);
+
+int fractal(ld_complex_t top, ld_complex_t bottom, int which_fractal, unsigned int seed, struct buffer_t *buf);
+int fractal_count(void);
+int fractal_symmetry(int which_fractal);
+int register_fractal(fractal_fn f, int symmetry);
+SDL_Color get_color(ld_complex_t z, unsigned int iteration);
+
+#endif // FRACTAL_H_MATTONI
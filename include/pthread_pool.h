@@ -23,6 +23,20 @@ void * pool_start(void * (*thread_func)(void *), unsigned int threads);
  */
 void pool_enqueue(void *pool, void *arg, char free);
 
+/**
+ * Enqueue a new task ahead of every queued task with a lower priority.
+ *
+ * Tasks of equal priority still run in the order they were enqueued, and
+ * pool_enqueue uses priority 0. Tasks that are already running are not
+ * interrupted.
+ *
+ * \param pool A thread pool returned by start_pool.
+ * \param arg The argument to pass to the thread worker function.
+ * \param free If true, the argument will be freed after the task has completed.
+ * \param priority Higher values are dequeued first.
+ */
+void pool_enqueue_priority(void *pool, void *arg, char free, int priority);
+
 /**
  * Wait for all queued tasks to be completed.
  */
@@ -0,0 +1,89 @@
+#ifndef RENDER_CTX_H_MATTONI
+#define RENDER_CTX_H_MATTONI
+
+/*
+ * Reentrant rendering interface.
+ *
+ * An engine owns a thread pool that any number of render contexts share. Each context is one
+ * render job with its own fractal parameters and target buffer; it is cut into tiles that are
+ * queued on the engine by priority, so tiles of an interactive job are picked up before the
+ * queued tiles of batch jobs (tiles that are already running are allowed to finish).
+ *
+ * When the fractal is symmetric and the viewport contains both halves on the same pixel grid, the
+ * pixels of one half are not computed but copied from the other once all tiles are done.
+ */
+
+#include <complex.h>
+#include <pthread.h>
+#include <SDL2/SDL.h>
+
+#include "buffer.h"
+#include "mattoni_types.h"
+
+#define RENDER_PRIORITY_BATCH 0
+#define RENDER_PRIORITY_INTERACTIVE 10
+
+struct render_ctx_t;
+
+// Callbacks run on pool threads. A context must not be freed from its own callbacks.
+typedef void (*render_tile_fn)(struct render_ctx_t *ctx, SDL_Rect tile);
+typedef void (*render_done_fn)(struct render_ctx_t *ctx);
+
+struct render_engine_t {
+    void *pool;
+    unsigned int threads;
+};
+
+/*
+ * Other work can share the engine's threads too: put this as the first member of a malloc'ed
+ * luggage and hand it to engine_enqueue. run is called on a pool thread, then the luggage is freed.
+ */
+struct engine_task_t {
+    void (*run)(struct engine_task_t *task);
+};
+
+struct render_ctx_t {
+    struct render_engine_t *engine;
+
+    // Set by make_render_ctx; may be changed before render_submit.
+    int which_fractal;
+    unsigned int seed;
+    struct buffer_t *target;
+    int priority;
+    unsigned int horizontal_regions;
+    unsigned int vertical_regions;
+    render_tile_fn on_tile;    // called once per finished tile, may be NULL
+    render_done_fn on_done;    // called once after the last tile, may be NULL
+    void *user;
+
+    // Progress of the current job, guarded by lock.
+    unsigned int tiles;
+    unsigned int tiles_done;
+    unsigned int tiles_cancelled;
+    int cancelled;
+    int busy;                  // cleared once on_done has returned
+
+    // Pixels (x, y) inside mirror are copied from (mirror_kx - x, mirror_ky - y) for a rotation,
+    // or from (x, mirror_ky - y) for a conjugate symmetry. Empty when nothing is mirrored.
+    int symmetry;
+    SDL_Rect mirror;
+    long mirror_kx;
+    long mirror_ky;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+};
+
+struct render_engine_t *make_render_engine(unsigned int threads);
+void free_render_engine(struct render_engine_t **engine);
+void engine_enqueue(struct render_engine_t *engine, struct engine_task_t *task, int priority);
+
+struct render_ctx_t *make_render_ctx(struct render_engine_t *engine, int which_fractal, unsigned int seed,
+                                     struct buffer_t *target);
+void free_render_ctx(struct render_ctx_t **ctx);
+
+void render_submit(struct render_ctx_t *ctx, ld_complex_t viewport_top, ld_complex_t viewport_bot);
+void render_cancel(struct render_ctx_t *ctx);
+void render_wait(struct render_ctx_t *ctx);
+int render_finished(struct render_ctx_t *ctx);
+
+#endif // RENDER_CTX_H_MATTONI
@@ -0,0 +1,20 @@
+#ifndef TRACE_H_MATTONI
+#define TRACE_H_MATTONI
+
+/* Recording user input and replaying it headless to measure interactive latency */
+
+#include <stdio.h>
+#include <SDL2/SDL.h>
+
+struct trace_t {
+    FILE *file;
+};
+
+struct trace_t *make_trace(const char *path, int which_fractal, unsigned int seed, int buddhabrot_kind,
+                           const char *formula);
+void trace_record(struct trace_t *trace, const SDL_Event *event);
+void free_trace(struct trace_t **trace);
+
+int replay_trace(const char *path);
+
+#endif // TRACE_H_MATTONI
@@ -0,0 +1,32 @@
+#ifndef VIEWPORT_H_MATTONI
+#define VIEWPORT_H_MATTONI
+
+/* Interface for moving the viewport around in response to user input */
+
+#include <complex.h>
+#include <SDL2/SDL.h>
+
+#include "mattoni_types.h"
+
+#define WINDOW_WIDTH 1600
+#define WINDOW_HEIGHT 1200
+
+#define HORIZONTAL_REGIONS 16
+#define VERTICAL_REGIONS 16
+
+struct view_t {
+    ld_complex_t top;
+    ld_complex_t bottom;
+    int down_x;    // where the last mouse drag started
+    int down_y;
+};
+
+void init_view(struct view_t *view);
+int view_event(struct view_t *view, const SDL_Event *event);
+
+void change_viewport(int down_x, int down_y, int up_x, int up_y,
+                     ld_complex_t *viewport_top, ld_complex_t *viewport_bottom);
+void change_centre(int centre_x, int centre_y, ld_complex_t *viewport_top, ld_complex_t *viewport_bottom);
+void zoom(float factor, ld_complex_t *viewport_top, ld_complex_t *viewport_bottom);
+
+#endif // VIEWPORT_H_MATTONI
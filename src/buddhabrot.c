@@ -0,0 +1,296 @@
+/* Orbit-density (Buddhabrot) renderer */
+
+#include <complex.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buddhabrot.h"
+
+// Each sampling task keeps a full-size histogram, so the thread count is capped to bound memory.
+#define BUDDHABROT_MAX_TASKS 16
+
+// Iteration limits of each channel. The Nebulabrot uses red, green and blue in this order.
+static unsigned int buddhabrot_limits[3] = {5000, 500, 50};
+#define BUDDHABROT_LIMIT 1000
+#define ANTI_BUDDHABROT_LIMIT 200
+
+enum buddhabrot_task_kind_t {
+    TASK_SAMPLE,
+    TASK_REDUCE,
+    TASK_TONEMAP
+};
+
+/* Contains data to send to buddhabrot workers. */
+struct buddhabrot_luggage_t {
+    struct engine_task_t engine_task;
+    int task;
+    struct buddhabrot_t *bb;
+    unsigned int index;          // histogram owned by a sampling task, or band of a reduction task
+    unsigned long samples;
+    uint64_t rng;
+};
+
+static void buddhabrot_worker(struct engine_task_t *task);
+
+struct buddhabrot_t *make_buddhabrot(struct render_engine_t *engine, int kind, ld_complex_t top,
+                                     ld_complex_t bottom, size_t width, size_t height) {
+
+    struct buddhabrot_t *bb = (struct buddhabrot_t *)malloc(sizeof(struct buddhabrot_t));
+    bb->kind = kind;
+    bb->width = width;
+    bb->height = height;
+    bb->channels = (kind == NEBULABROT) ? 3 : 1;
+    bb->engine = engine;
+    bb->priority = RENDER_PRIORITY_BATCH;
+    bb->pending = 0;
+    pthread_mutex_init(&bb->lock, NULL);
+    pthread_cond_init(&bb->stage_done, NULL);
+
+    // One histogram per engine thread: more tasks could not run at the same time anyway.
+    unsigned int threads = engine->threads;
+    bb->tasks = (threads < 1) ? 1 : (threads > BUDDHABROT_MAX_TASKS) ? BUDDHABROT_MAX_TASKS : threads;
+
+    size_t cells = bb->channels * width * height;
+    bb->histograms = (uint32_t **)malloc(sizeof(uint32_t *) * bb->tasks);
+    for (unsigned int t = 0; t < bb->tasks; t++) {
+        bb->histograms[t] = (uint32_t *)calloc(cells, sizeof(uint32_t));
+    }
+    bb->total = (uint32_t *)calloc(cells, sizeof(uint32_t));
+    bb->band_max = (uint32_t *)calloc(bb->tasks * bb->channels, sizeof(uint32_t));
+    bb->buf = make_buffer(width, height);
+    buddhabrot_reset(bb, top, bottom);
+
+    return bb;
+}
+
+/* Starts over on a new viewport, keeping the histograms that are already allocated. */
+void buddhabrot_reset(struct buddhabrot_t *bb, ld_complex_t top, ld_complex_t bottom) {
+    size_t cells = bb->channels * bb->width * bb->height;
+    bb->top = top;
+    bb->bottom = bottom;
+    bb->passes = 0;
+    bb->samples = 0;
+    for (unsigned int t = 0; t < bb->tasks; t++) {
+        memset(bb->histograms[t], 0, cells * sizeof(uint32_t));
+    }
+    for (size_t p = 0; p < bb->width * bb->height; p++) {
+        SDL_Color black = {0, 0, 0, 255};
+        bb->buf->colors[p] = black;
+    }
+}
+
+/* No pass may be running. */
+void free_buddhabrot(struct buddhabrot_t **bb) {
+    pthread_mutex_destroy(&(*bb)->lock);
+    pthread_cond_destroy(&(*bb)->stage_done);
+    for (unsigned int t = 0; t < (*bb)->tasks; t++) {
+        free((*bb)->histograms[t]);
+    }
+    free((*bb)->histograms);
+    free((*bb)->total);
+    free((*bb)->band_max);
+    free_buffer(&(*bb)->buf);
+    free(*bb);
+    *bb = NULL;
+}
+
+/* Runs one stage on the engine and waits for its tasks only, not for other work on the engine. */
+static void enqueue_tasks(struct buddhabrot_t *bb, int task, unsigned long samples) {
+    pthread_mutex_lock(&bb->lock);
+    bb->pending = bb->tasks;
+    pthread_mutex_unlock(&bb->lock);
+
+    for (unsigned int t = 0; t < bb->tasks; t++) {
+        struct buddhabrot_luggage_t *luggage = malloc(sizeof (struct buddhabrot_luggage_t));
+        luggage->engine_task.run = buddhabrot_worker;
+        luggage->task = task;
+        luggage->bb = bb;
+        luggage->index = t;
+        luggage->samples = samples / bb->tasks + (t < samples % bb->tasks);
+        // Different stream for every task and pass, never zero.
+        luggage->rng = ((uint64_t) bb->passes << 32) ^ ((t + 1) * 0x9E3779B97F4A7C15ULL);
+        engine_enqueue(bb->engine, &luggage->engine_task, bb->priority);
+    }
+
+    pthread_mutex_lock(&bb->lock);
+    while (bb->pending > 0) {
+        pthread_cond_wait(&bb->stage_done, &bb->lock);
+    }
+    pthread_mutex_unlock(&bb->lock);
+}
+
+/*
+ * Runs one progressive pass: plots `samples` more orbits into the per-task histograms, sums them
+ * and refreshes bb->buf. The three stages each fan out over the engine and wait for each other.
+ */
+void buddhabrot_pass(struct buddhabrot_t *bb, unsigned long samples) {
+    enqueue_tasks(bb, TASK_SAMPLE, samples);
+    enqueue_tasks(bb, TASK_REDUCE, 0);
+    enqueue_tasks(bb, TASK_TONEMAP, 0);
+    bb->passes++;
+    bb->samples += samples;
+}
+
+/* xorshift64*, returns a uniform double in [0, 1) */
+static double next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (double) ((*state * 0x2545F4914F6CDD1DULL) >> 11) / (double) (1ULL << 53);
+}
+
+/* true for points of the main cardioid and the period-2 bulb, which never escape */
+static int in_main_bulbs(double x, double y) {
+    double q = (x - 0.25) * (x - 0.25) + y * y;
+    if (q * (q + (x - 0.25)) <= 0.25 * y * y) {
+        return 1;
+    }
+    return (x + 1) * (x + 1) + y * y <= 0.0625;
+}
+
+static void sample_orbits(struct buddhabrot_luggage_t *luggage) {
+    struct buddhabrot_t *bb = luggage->bb;
+    uint32_t *hist = bb->histograms[luggage->index];
+    size_t plane = bb->width * bb->height;
+
+    unsigned int limits[3];
+    unsigned int max_limit = 0;
+    for (unsigned int ch = 0; ch < bb->channels; ch++) {
+        limits[ch] = (bb->kind == NEBULABROT) ? buddhabrot_limits[ch]
+                   : (bb->kind == ANTI_BUDDHABROT) ? ANTI_BUDDHABROT_LIMIT : BUDDHABROT_LIMIT;
+        max_limit = (limits[ch] > max_limit) ? limits[ch] : max_limit;
+    }
+
+    double left = creall(bb->top);
+    double top = cimagl(bb->top);
+    double scale_x = bb->width / (double) (creall(bb->bottom) - creall(bb->top));
+    double scale_y = bb->height / (double) (cimagl(bb->top) - cimagl(bb->bottom));
+
+    double complex *orbit = malloc(sizeof(double complex) * max_limit);
+    for (unsigned long s = 0; s < luggage->samples; s++) {
+        double cx = 4 * next_random(&luggage->rng) - 2;
+        double cy = 4 * next_random(&luggage->rng) - 2;
+        int bulb = in_main_bulbs(cx, cy);
+        if (bulb && bb->kind != ANTI_BUDDHABROT) {
+            continue;
+        }
+
+        double complex c = CMPLX(cx, cy);
+        double complex z = 0;
+        unsigned int n = 0;
+        if (bulb) {
+            // Known not to escape, just collect the orbit.
+            for (; n < max_limit; n++) {
+                z = z*z + c;
+                orbit[n] = z;
+            }
+        } else {
+            while (n < max_limit) {
+                z = z*z + c;
+                orbit[n++] = z;
+                if (creal(z)*creal(z) + cimag(z)*cimag(z) > 4.0) {
+                    break;
+                }
+            }
+        }
+        int escaped = (creal(z)*creal(z) + cimag(z)*cimag(z) > 4.0);
+
+        for (unsigned int ch = 0; ch < bb->channels; ch++) {
+            int wanted = (bb->kind == ANTI_BUDDHABROT) ? !escaped : (escaped && n <= limits[ch]);
+            if (!wanted) {
+                continue;
+            }
+            for (unsigned int k = 0; k < n; k++) {
+                double px = (creal(orbit[k]) - left) * scale_x;
+                double py = (top - cimag(orbit[k])) * scale_y;
+                if (px >= 0 && py >= 0 && px < bb->width && py < bb->height) {
+                    hist[ch * plane + (size_t) px + (size_t) py * bb->width]++;
+                }
+            }
+        }
+    }
+    free(orbit);
+}
+
+/* Rows [first, last) of the band handled by a reduction or tone-mapping task. */
+static void band_rows(struct buddhabrot_t *bb, unsigned int band, size_t *first, size_t *last) {
+    *first = bb->height * band / bb->tasks;
+    *last = bb->height * (band + 1) / bb->tasks;
+}
+
+static void reduce_band(struct buddhabrot_luggage_t *luggage) {
+    struct buddhabrot_t *bb = luggage->bb;
+    size_t plane = bb->width * bb->height;
+    size_t first, last;
+    band_rows(bb, luggage->index, &first, &last);
+
+    for (unsigned int ch = 0; ch < bb->channels; ch++) {
+        uint32_t max = 0;
+        for (size_t p = ch * plane + first * bb->width; p < ch * plane + last * bb->width; p++) {
+            uint32_t sum = 0;
+            for (unsigned int t = 0; t < bb->tasks; t++) {
+                sum += bb->histograms[t][p];
+            }
+            bb->total[p] = sum;
+            max = (sum > max) ? sum : max;
+        }
+        bb->band_max[luggage->index * bb->channels + ch] = max;
+    }
+}
+
+static void tonemap_band(struct buddhabrot_luggage_t *luggage) {
+    struct buddhabrot_t *bb = luggage->bb;
+    size_t plane = bb->width * bb->height;
+    size_t first, last;
+    band_rows(bb, luggage->index, &first, &last);
+
+    // Every reduction task has finished, so the maxima of all bands can be read.
+    float max[3];
+    for (unsigned int ch = 0; ch < bb->channels; ch++) {
+        uint32_t m = 1;
+        for (unsigned int b = 0; b < bb->tasks; b++) {
+            uint32_t v = bb->band_max[b * bb->channels + ch];
+            m = (v > m) ? v : m;
+        }
+        max[ch] = m;
+    }
+
+    for (size_t p = first * bb->width; p < last * bb->width; p++) {
+        // Square root brings out the faint orbits without washing out the dense ones.
+        Uint8 value[3] = {0, 0, 0};
+        for (unsigned int ch = 0; ch < bb->channels; ch++) {
+            value[ch] = (Uint8) (sqrtf(bb->total[ch * plane + p] / max[ch]) * 255);
+        }
+        SDL_Color col = {value[0], value[0], value[0], 255};
+        if (bb->channels == 3) {
+            col.g = value[1];
+            col.b = value[2];
+        }
+        bb->buf->colors[p] = col;
+    }
+}
+
+static void buddhabrot_worker(struct engine_task_t *task) {
+    struct buddhabrot_luggage_t *luggage = (struct buddhabrot_luggage_t *)task;
+    struct buddhabrot_t *bb = luggage->bb;
+
+    switch (luggage->task) {
+        case TASK_SAMPLE:
+            sample_orbits(luggage);
+            break;
+        case TASK_REDUCE:
+            reduce_band(luggage);
+            break;
+        case TASK_TONEMAP:
+            tonemap_band(luggage);
+            break;
+    }
+
+    pthread_mutex_lock(&bb->lock);
+    if (--bb->pending == 0) {
+        pthread_cond_signal(&bb->stage_done);
+    }
+    pthread_mutex_unlock(&bb->lock);
+}
@@ -0,0 +1,673 @@
+/* User-defined formulas compiled to native escape-time kernels */
+
+#include <ctype.h>
+#include <dlfcn.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "formula.h"
+#include "fractal.h"
+
+/*
+ * A formula goes through four steps: it is parsed into an expression tree, the tree is simplified,
+ * C source for a whole kernel (with the formula inlined into the escape-time loop) is generated
+ * from it, and that source is built into a shared object with the local compiler and loaded with
+ * dlopen. Shared objects are kept in FORMULA_CACHE_DIR, named after a hash of their source, of the
+ * compiler command and of the headers they are built against, so a formula is only ever compiled
+ * once per build setup; within one run the same formula also maps to the same entry. Each object
+ * carries its hash and is only loaded if the hash matches.
+ *
+ * The kernel iterates z -> f(z, c) starting from z = c, counted as the first iteration (as if from
+ * z = 0 for "z^2 + c"), with the same bailout and colouring as the built-in fractals.
+ */
+
+#define FORMULA_CACHE_DIR "formula_cache"
+#define MAX_LOADED_FORMULAS 32
+
+// Bump when the contract between Mattoni and a kernel changes in a way that the hashed source,
+// command and headers don't show, e.g. the meaning of an argument.
+#define FORMULA_KERNEL_ABI 1
+
+// Limited-range complex arithmetic skips the C99 inf/nan recovery in every multiplication.
+#define FORMULA_CFLAGS "-O2 -fcx-limited-range -shared -fPIC"
+
+// Set by the Makefile so that generated kernels can include our headers.
+#ifndef MATTONI_INCDIR
+#define MATTONI_INCDIR "include"
+#endif
+#ifndef MATTONI_SDLFLAGS
+#define MATTONI_SDLFLAGS ""
+#endif
+
+// Integer powers up to this are expanded into multiplications, others go through cpowl.
+#define MAX_EXPANDED_POWER 32
+
+enum node_kind_t {
+    NODE_NUMBER,
+    NODE_Z,
+    NODE_C,
+    NODE_I,
+    NODE_ADD,
+    NODE_SUB,
+    NODE_MUL,
+    NODE_DIV,
+    NODE_POW,
+    NODE_NEG,
+    NODE_CALL
+};
+
+struct node_t {
+    int kind;
+    long double value;         // NODE_NUMBER
+    int func;                  // NODE_CALL, index into formula_functions
+    const char *at;            // where in the formula the number or operator is, for errors
+    struct node_t *left;
+    struct node_t *right;
+};
+
+// Functions a formula may call, with the C function each one compiles to.
+static const char *formula_functions[][2] = {
+    {"sin", "csinl"}, {"cos", "ccosl"}, {"tan", "ctanl"},
+    {"sinh", "csinhl"}, {"cosh", "ccoshl"}, {"tanh", "ctanhl"},
+    {"exp", "cexpl"}, {"log", "clogl"}, {"sqrt", "csqrtl"},
+    {"conj", "conjl"}
+};
+#define NUM_FUNCTIONS (sizeof(formula_functions) / sizeof(formula_functions[0]))
+
+struct parser_t {
+    const char *text;
+    const char *pos;
+    const char *error;
+};
+
+struct loaded_formula_t {
+    uint64_t hash;
+    int which_fractal;
+};
+
+// Guards loaded_formulas and the cache directory, so formulas can be compiled while rendering.
+static pthread_mutex_t formula_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct loaded_formula_t loaded_formulas[MAX_LOADED_FORMULAS];
+static int num_loaded_formulas = 0;
+
+static struct node_t *make_node(int kind, struct node_t *left, struct node_t *right) {
+    struct node_t *node = (struct node_t *)calloc(1, sizeof(struct node_t));
+    node->kind = kind;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+static struct node_t *make_number(long double value, const char *at) {
+    struct node_t *node = make_node(NODE_NUMBER, NULL, NULL);
+    node->value = value;
+    node->at = at;
+    return node;
+}
+
+static struct node_t *make_operator(int kind, struct node_t *left, struct node_t *right, const char *at) {
+    struct node_t *node = make_node(kind, left, right);
+    node->at = at;
+    return node;
+}
+
+static void free_node(struct node_t *node) {
+    if (node != NULL) {
+        free_node(node->left);
+        free_node(node->right);
+        free(node);
+    }
+}
+
+/* Parsing, by recursive descent. ^ binds tightest and is right-associative, then unary minus. */
+
+static struct node_t *parse_sum(struct parser_t *p);
+
+static void skip_spaces(struct parser_t *p) {
+    while (isspace((unsigned char) *p->pos)) {
+        p->pos++;
+    }
+}
+
+static int accept(struct parser_t *p, char c) {
+    skip_spaces(p);
+    if (*p->pos == c) {
+        p->pos++;
+        return 1;
+    }
+    return 0;
+}
+
+static struct node_t *fail(struct parser_t *p, const char *error, struct node_t *partial) {
+    if (p->error == NULL) {
+        p->error = error;
+    }
+    free_node(partial);
+    return NULL;
+}
+
+static struct node_t *parse_primary(struct parser_t *p) {
+    skip_spaces(p);
+
+    if (isdigit((unsigned char) *p->pos) || *p->pos == '.') {
+        char *end;
+        long double value = strtold(p->pos, &end);
+        if (end == p->pos) {
+            return fail(p, "malformed number", NULL);
+        }
+        if (!isfinite(value)) {
+            return fail(p, "number too large", NULL);
+        }
+        const char *start = p->pos;
+        p->pos = end;
+        return make_number(value, start);
+    }
+
+    if (accept(p, '(')) {
+        struct node_t *inner = parse_sum(p);
+        if (inner == NULL || !accept(p, ')')) {
+            return fail(p, "expected ')'", inner);
+        }
+        return inner;
+    }
+
+    if (isalpha((unsigned char) *p->pos)) {
+        const char *start = p->pos;
+        while (isalnum((unsigned char) *p->pos)) {
+            p->pos++;
+        }
+        size_t len = p->pos - start;
+
+        if (len == 1 && *start == 'z') return make_node(NODE_Z, NULL, NULL);
+        if (len == 1 && *start == 'c') return make_node(NODE_C, NULL, NULL);
+        if (len == 1 && *start == 'i') return make_node(NODE_I, NULL, NULL);
+
+        for (int f = 0; f < NUM_FUNCTIONS; f++) {
+            if (strlen(formula_functions[f][0]) == len && strncmp(start, formula_functions[f][0], len) == 0) {
+                if (!accept(p, '(')) {
+                    return fail(p, "expected '(' after function name", NULL);
+                }
+                struct node_t *arg = parse_sum(p);
+                if (arg == NULL || !accept(p, ')')) {
+                    return fail(p, "expected ')'", arg);
+                }
+                struct node_t *call = make_node(NODE_CALL, arg, NULL);
+                call->func = f;
+                return call;
+            }
+        }
+        p->pos = start;
+        return fail(p, "unknown name (use z, c, i or a function)", NULL);
+    }
+
+    return fail(p, "expected a number, z, c, i, a function or '('", NULL);
+}
+
+static struct node_t *parse_unary(struct parser_t *p);
+
+static struct node_t *parse_power(struct parser_t *p) {
+    struct node_t *base = parse_primary(p);
+    if (base != NULL && accept(p, '^')) {
+        const char *at = p->pos - 1;
+        struct node_t *exponent = parse_unary(p);
+        if (exponent == NULL) {
+            return fail(p, "expected an exponent", base);
+        }
+        return make_operator(NODE_POW, base, exponent, at);
+    }
+    return base;
+}
+
+static struct node_t *parse_unary(struct parser_t *p) {
+    if (accept(p, '-')) {
+        const char *at = p->pos - 1;
+        struct node_t *operand = parse_unary(p);
+        return (operand == NULL) ? NULL : make_operator(NODE_NEG, operand, NULL, at);
+    }
+    accept(p, '+');
+    return parse_power(p);
+}
+
+static struct node_t *parse_product(struct parser_t *p) {
+    struct node_t *left = parse_unary(p);
+    while (left != NULL) {
+        int kind;
+        if (accept(p, '*')) {
+            kind = NODE_MUL;
+        } else if (accept(p, '/')) {
+            kind = NODE_DIV;
+        } else {
+            break;
+        }
+        const char *at = p->pos - 1;
+        struct node_t *right = parse_unary(p);
+        if (right == NULL) {
+            return fail(p, "expected an operand", left);
+        }
+        left = make_operator(kind, left, right, at);
+    }
+    return left;
+}
+
+static struct node_t *parse_sum(struct parser_t *p) {
+    struct node_t *left = parse_product(p);
+    while (left != NULL) {
+        int kind;
+        if (accept(p, '+')) {
+            kind = NODE_ADD;
+        } else if (accept(p, '-')) {
+            kind = NODE_SUB;
+        } else {
+            break;
+        }
+        const char *at = p->pos - 1;
+        struct node_t *right = parse_product(p);
+        if (right == NULL) {
+            return fail(p, "expected an operand", left);
+        }
+        left = make_operator(kind, left, right, at);
+    }
+    return left;
+}
+
+/* Simplification: folds real constants and drops operations by 0 and 1. */
+
+static int is_number(struct node_t *node, long double value) {
+    return node->kind == NODE_NUMBER && node->value == value;
+}
+
+/* Replaces node by one of its children, freeing the rest. */
+static struct node_t *keep(struct node_t *node, struct node_t *child) {
+    if (node->left != child) free_node(node->left);
+    if (node->right != child) free_node(node->right);
+    free(node);
+    return child;
+}
+
+static struct node_t *replace(struct node_t *node, struct node_t *with) {
+    free_node(node);
+    return with;
+}
+
+/*
+ * Replaces node by the constant it evaluates to. A constant that overflows can't be written in C,
+ * so it is reported at the operator that produced it and node is kept as it is.
+ */
+static struct node_t *fold(struct parser_t *p, struct node_t *node, long double value) {
+    if (!isfinite(value)) {
+        if (p->error == NULL) {
+            p->pos = node->at;
+            p->error = "constant is too large";
+        }
+        return node;
+    }
+    return replace(node, make_number(value, node->at));
+}
+
+static struct node_t *simplify(struct parser_t *p, struct node_t *node) {
+    if (node->left != NULL) node->left = simplify(p, node->left);
+    if (node->right != NULL) node->right = simplify(p, node->right);
+    struct node_t *l = node->left;
+    struct node_t *r = node->right;
+
+    switch (node->kind) {
+        case NODE_ADD:
+            if (l->kind == NODE_NUMBER && r->kind == NODE_NUMBER) return fold(p, node, l->value + r->value);
+            if (is_number(l, 0)) return keep(node, r);
+            if (is_number(r, 0)) return keep(node, l);
+            break;
+        case NODE_SUB:
+            if (l->kind == NODE_NUMBER && r->kind == NODE_NUMBER) return fold(p, node, l->value - r->value);
+            if (is_number(r, 0)) return keep(node, l);
+            break;
+        case NODE_MUL:
+            if (l->kind == NODE_NUMBER && r->kind == NODE_NUMBER) return fold(p, node, l->value * r->value);
+            if (is_number(l, 1)) return keep(node, r);
+            if (is_number(r, 1)) return keep(node, l);
+            if (is_number(l, 0) || is_number(r, 0)) return fold(p, node, 0);
+            break;
+        case NODE_DIV:
+            if (is_number(r, 0)) {
+                if (p->error == NULL) {
+                    p->pos = node->at;
+                    p->error = "division by zero";
+                }
+                return node;
+            }
+            if (l->kind == NODE_NUMBER && r->kind == NODE_NUMBER) {
+                return fold(p, node, l->value / r->value);
+            }
+            if (is_number(r, 1)) return keep(node, l);
+            break;
+        case NODE_POW:
+            if (is_number(r, 1)) return keep(node, l);
+            if (is_number(r, 0)) return fold(p, node, 1);
+            if (l->kind == NODE_NUMBER && r->kind == NODE_NUMBER && l->value > 0) {
+                return fold(p, node, powl(l->value, r->value));
+            }
+            break;
+        case NODE_NEG:
+            if (l->kind == NODE_NUMBER) return fold(p, node, -l->value);
+            if (l->kind == NODE_NEG) {
+                struct node_t *inner = l->left;
+                l->left = NULL;
+                return replace(node, inner);
+            }
+            break;
+    }
+    return node;
+}
+
+/* true if the formula commutes with conjugation, i.e. it only has real constants */
+static int is_real(struct node_t *node) {
+    if (node == NULL) return 1;
+    if (node->kind == NODE_I) return 0;
+    return is_real(node->left) && is_real(node->right);
+}
+
+/* Code generation */
+
+struct source_t {
+    char *text;
+    size_t len;
+    size_t cap;
+    unsigned char powers[MAX_EXPANDED_POWER + 1];  // which ipow<n> helpers are needed
+};
+
+static void emit(struct source_t *src, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    if (src->len + n + 1 > src->cap) {
+        src->cap = 2 * (src->len + n + 1);
+        src->text = realloc(src->text, src->cap);
+    }
+    va_start(args, fmt);
+    vsnprintf(src->text + src->len, n + 1, fmt, args);
+    va_end(args);
+    src->len += n;
+}
+
+static int expanded_power(struct node_t *exponent) {
+    long double n = exponent->value;
+    return exponent->kind == NODE_NUMBER && n == floorl(n) && n >= 2 && n <= MAX_EXPANDED_POWER;
+}
+
+static void emit_expr(struct source_t *src, struct node_t *node) {
+    static const char ops[] = {[NODE_ADD] = '+', [NODE_SUB] = '-', [NODE_MUL] = '*', [NODE_DIV] = '/'};
+
+    switch (node->kind) {
+        case NODE_NUMBER:
+            // Always with an exponent, so that whole numbers are long double literals, not integers.
+            emit(src, "%.21LeL", node->value);
+            break;
+        case NODE_Z:
+            emit(src, "z");
+            break;
+        case NODE_C:
+            emit(src, "c");
+            break;
+        case NODE_I:
+            emit(src, "CMPLXL(0.0, 1.0)");
+            break;
+        case NODE_ADD:
+        case NODE_SUB:
+        case NODE_MUL:
+        case NODE_DIV:
+            emit(src, "(");
+            emit_expr(src, node->left);
+            emit(src, " %c ", ops[node->kind]);
+            emit_expr(src, node->right);
+            emit(src, ")");
+            break;
+        case NODE_POW:
+            if (expanded_power(node->right)) {
+                int n = (int) node->right->value;
+                src->powers[n] = 1;
+                emit(src, "ipow%d(", n);
+                emit_expr(src, node->left);
+                emit(src, ")");
+            } else {
+                emit(src, "cpowl(");
+                emit_expr(src, node->left);
+                emit(src, ", ");
+                emit_expr(src, node->right);
+                emit(src, ")");
+            }
+            break;
+        case NODE_NEG:
+            emit(src, "(-");
+            emit_expr(src, node->left);
+            emit(src, ")");
+            break;
+        case NODE_CALL:
+            emit(src, "%s(", formula_functions[node->func][1]);
+            emit_expr(src, node->left);
+            emit(src, ")");
+            break;
+    }
+}
+
+/*
+ * Square-and-multiply for x^n, so z^2 costs one multiplication and z^3 two. The result starts as
+ * the power of the lowest set bit rather than 1, which would cost an extra multiplication.
+ */
+static void emit_power_helper(struct source_t *src, int n) {
+    emit(src, "static inline ld_complex_t ipow%d(ld_complex_t x) {\n", n);
+    emit(src, "    ld_complex_t result;\n");
+    int started = 0;
+    for (int bit = 0; (1 << bit) <= n; bit++) {
+        if (bit > 0) {
+            emit(src, "    x = x * x;\n");
+        }
+        if (n & (1 << bit)) {
+            emit(src, started ? "    result = result * x;\n" : "    result = x;\n");
+            started = 1;
+        }
+    }
+    emit(src, "    return result;\n}\n\n");
+}
+
+/* The source only depends on the simplified formula, so equivalent spellings share a cache entry. */
+static char *generate_kernel(struct node_t *tree) {
+    struct source_t body = {NULL, 0, 0, {0}};
+    emit_expr(&body, tree);
+
+    struct source_t src = {NULL, 0, 0, {0}};
+    emit(&src, "/* Generated by Mattoni */\n\n");
+    emit(&src, "#include <complex.h>\n#include <math.h>\n\n#include \"buffer.h\"\n#include \"mattoni_types.h\"\n\n");
+    emit(&src, "static SDL_Color (*get_color)(ld_complex_t, unsigned int);\n\n");
+    emit(&src, "void mattoni_formula_init(SDL_Color (*colour)(ld_complex_t, unsigned int)) {\n");
+    emit(&src, "    get_color = colour;\n}\n\n");
+    for (int n = 2; n <= MAX_EXPANDED_POWER; n++) {
+        if (body.powers[n]) {
+            emit_power_helper(&src, n);
+        }
+    }
+    emit(&src,
+        "void mattoni_formula(ld_complex_t top, ld_complex_t bottom, unsigned int seed, struct buffer_t *buf) {\n"
+        "    long double step_w = (creall(bottom) - creall(top)) / buf->width;\n"
+        "    long double step_h = (cimagl(bottom) - cimagl(top)) / buf->height;\n"
+        "    for (unsigned int i = 0; i < buf->width; i++) {\n"
+        "        for (unsigned int j = 0; j < buf->height; j++) {\n"
+        "            unsigned int iteration = 1;\n"
+        "            ld_complex_t c = top + CMPLXL(i * step_w, j * step_h);\n"
+        "            ld_complex_t z = c;\n"
+        "            while (creall(z)*creall(z) + cimagl(z)*cimagl(z) <= 4.0 && iteration < %d) {\n"
+        "                z = %s;\n"
+        "                iteration++;\n"
+        "            }\n"
+        "            buf->colors[i + j * buf->width] = get_color(z, iteration);\n"
+        "        }\n"
+        "    }\n"
+        "}\n", MAX_ITERATIONS, body.text);
+
+    free(body.text);
+    return src.text;
+}
+
+/* FNV-1a, continuing from hash */
+static uint64_t hash_string(uint64_t hash, const char *s) {
+    for (; *s; s++) {
+        hash ^= (unsigned char) *s;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t hash_file(uint64_t hash, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return hash_string(hash, path);
+    }
+    char chunk[512];
+    while (fgets(chunk, sizeof chunk, file) != NULL) {
+        hash = hash_string(hash, chunk);
+    }
+    fclose(file);
+    return hash;
+}
+
+/* The compiler and flags a kernel is built with, without its input and output paths. */
+static int compiler_command(char *command, size_t size) {
+    const char *cc = getenv("CC") ? getenv("CC") : "cc";
+    int length = snprintf(command, size, "%s " FORMULA_CFLAGS " -I%s %s", cc, MATTONI_INCDIR, MATTONI_SDLFLAGS);
+    return (length < (int) size) ? 0 : -1;
+}
+
+/* Everything the shared object depends on, so that a stale one is never picked from the cache. */
+static uint64_t kernel_hash(const char *source, const char *command) {
+    char abi[32];
+    snprintf(abi, sizeof abi, "abi %d\n", FORMULA_KERNEL_ABI);
+    uint64_t hash = hash_string(14695981039346656037ULL, abi);
+    hash = hash_string(hash, command);
+    hash = hash_file(hash, MATTONI_INCDIR "/buffer.h");
+    hash = hash_file(hash, MATTONI_INCDIR "/mattoni_types.h");
+    return hash_string(hash, source);
+}
+
+/*
+ * Builds the shared object for a kernel unless the cache already has it. Returns 0 on success.
+ * The object is built under a temporary name and renamed into place, so that an interrupted or
+ * concurrent build never leaves a partial file where it could be loaded.
+ */
+static int build_kernel(const char *source, uint64_t hash, const char *command, const char *so_path) {
+    if (access(so_path, R_OK) == 0) {
+        return 0;
+    }
+
+    mkdir(FORMULA_CACHE_DIR, 0755);
+    char c_path[256], tmp_path[300];
+    snprintf(c_path, sizeof c_path, "%s/%016llx.%ld.c", FORMULA_CACHE_DIR, (unsigned long long) hash, (long) getpid());
+    snprintf(tmp_path, sizeof tmp_path, "%s.%ld.tmp", so_path, (long) getpid());
+    FILE *file = fopen(c_path, "w");
+    if (file == NULL) {
+        printf("Could not write %s.\n", c_path);
+        return -1;
+    }
+    fputs(source, file);
+    fprintf(file, "\nconst unsigned long long mattoni_formula_hash = 0x%016llxULL;\n", (unsigned long long) hash);
+    fclose(file);
+
+    // A truncated command would build something else, so a too long $CC is an error.
+    char build[1600];
+    int length = snprintf(build, sizeof build, "%s -o %s %s -lm", command, tmp_path, c_path);
+    int failed = (length >= (int) sizeof build || system(build) != 0 || rename(tmp_path, so_path) != 0);
+    if (failed) {
+        printf("Compiling the formula failed: %s\n", build);
+        remove(tmp_path);
+    }
+    remove(c_path);
+    return failed ? -1 : 0;
+}
+
+static int load_kernel(const char *source, uint64_t hash, const char *command, int symmetry);
+
+int compile_formula(const char *formula) {
+    struct parser_t parser = {formula, formula, NULL};
+    struct node_t *tree = parse_sum(&parser);
+    skip_spaces(&parser);
+    if (tree != NULL && *parser.pos != '\0') {
+        tree = fail(&parser, "unexpected character", tree);
+    }
+    if (tree != NULL) {
+        tree = simplify(&parser, tree);
+    }
+    if (parser.error != NULL) {
+        printf("Formula error at column %d: %s\n", (int) (parser.pos - formula) + 1, parser.error);
+        free_node(tree);
+        return -1;
+    }
+
+    int symmetry = is_real(tree) ? SYMMETRY_CONJUGATE : SYMMETRY_NONE;
+    char command[768];
+    if (compiler_command(command, sizeof command) != 0) {
+        printf("The compiler command is too long, check $CC.\n");
+        free_node(tree);
+        return -1;
+    }
+    char *source = generate_kernel(tree);
+    free_node(tree);
+
+    uint64_t hash = kernel_hash(source, command);
+    pthread_mutex_lock(&formula_lock);
+    int which_fractal = load_kernel(source, hash, command, symmetry);
+    pthread_mutex_unlock(&formula_lock);
+    free(source);
+    return which_fractal;
+}
+
+/* Looks the kernel up in the cache, building it if needed, and registers it. Needs formula_lock. */
+static int load_kernel(const char *source, uint64_t hash, const char *command, int symmetry) {
+    for (int k = 0; k < num_loaded_formulas; k++) {
+        if (loaded_formulas[k].hash == hash) {
+            return loaded_formulas[k].which_fractal;
+        }
+    }
+    if (num_loaded_formulas == MAX_LOADED_FORMULAS) {
+        printf("Too many formulas loaded.\n");
+        return -1;
+    }
+
+    char so_path[256];
+    snprintf(so_path, sizeof so_path, "./%s/%016llx.so", FORMULA_CACHE_DIR, (unsigned long long) hash);
+    if (build_kernel(source, hash, command, so_path) != 0) {
+        return -1;
+    }
+
+    void *library = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+    if (library == NULL) {
+        printf("Could not load the formula: %s\n", dlerror());
+        return -1;
+    }
+    void (*init)(SDL_Color (*)(ld_complex_t, unsigned int)) = dlsym(library, "mattoni_formula_init");
+    fractal_fn kernel = (fractal_fn) dlsym(library, "mattoni_formula");
+    const unsigned long long *built_hash = dlsym(library, "mattoni_formula_hash");
+    if (init == NULL || kernel == NULL || built_hash == NULL || *built_hash != hash) {
+        printf("%s is not the kernel of this formula, remove it to rebuild.\n", so_path);
+        dlclose(library);
+        return -1;
+    }
+    init(get_color);
+
+    // The library stays loaded for the rest of the run since the kernel is now in the table.
+    int which_fractal = register_fractal(kernel, symmetry);
+    if (which_fractal < 0) {
+        printf("Too many fractals registered.\n");
+        dlclose(library);
+        return -1;
+    }
+    loaded_formulas[num_loaded_formulas].hash = hash;
+    loaded_formulas[num_loaded_formulas].which_fractal = which_fractal;
+    num_loaded_formulas++;
+    return which_fractal;
+}
@@ -2,33 +2,110 @@
 
 #include <complex.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "buffer.h"
 #include "fractal.h"
 
-#define MAX_ITERATIONS 400
 #define NUM_COLOURS 9
 
+// Distance estimation needs a large escape radius for the estimate to be accurate. Pixels further
+// than DE_SHADE_PIXELS from the set are plain background, closer ones are shaded by their distance.
+#define DE_ESCAPE_RADIUS 1000.0
+#define DE_SHADE_PIXELS 4.0
+
+// Iterations of the critical orbit of a Julia set before it is taken to be bounded. Near the edge
+// of the Mandelbrot set the orbit of 0 can take far longer than MAX_ITERATIONS to escape.
+#define CRITICAL_ITERATIONS 1000000
+
 // These different functions (have the same signature) will compute different fractals.
 void mandelbrot(ld_complex_t top, ld_complex_t bottom, unsigned int seed, struct buffer_t *buf);
 void julia(ld_complex_t top, ld_complex_t bottom, unsigned int seed, struct buffer_t *buf);
 void ship(ld_complex_t top, ld_complex_t bottom, unsigned int seed, struct buffer_t *buf);
+void mandelbrot_de(ld_complex_t top, ld_complex_t bottom, unsigned int seed, struct buffer_t *buf);
+void julia_de(ld_complex_t top, ld_complex_t bottom, unsigned int seed, struct buffer_t *buf);
 
 // How to die:
-typedef void (*fractal_fn)(ld_complex_t, ld_complex_t, unsigned int, struct buffer_t *);
-fractal_fn fractal_types[3] = {
+fractal_fn fractal_types[MAX_FRACTALS] = {
     &mandelbrot,
     &julia,
-    &ship
+    &ship,
+    &mandelbrot_de,
+    &julia_de
+};
+
+// The orbit of conj(c) is the conjugate of the orbit of c, and z and -z have the same square, so
+// these symmetries leave both the iteration count and |z| (hence the colour) of a pixel unchanged.
+static int fractal_symmetries[MAX_FRACTALS] = {
+    SYMMETRY_CONJUGATE,
+    SYMMETRY_ROTATION,
+    SYMMETRY_NONE,
+    SYMMETRY_CONJUGATE,
+    SYMMETRY_ROTATION
 };
 
-void fractal(ld_complex_t top, ld_complex_t bottom, int which_fractal, unsigned int seed, struct buffer_t *buf) {
+// Entries below num_fractals are never changed again, so they can be read without locking once the
+// count has been loaded. registry_lock only keeps registrations from racing each other.
+static atomic_int num_fractals = NUM_BUILTIN_FRACTALS;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The constants c used for Julia sets, picked by the seed.
+static ld_complex_t julia_seeds[4] = {
+    CMPLXL(-0.8, 0.156),
+    CMPLXL(-0.4, 0.6),
+    CMPLXL(0.285, 0.01),
+    CMPLXL(-0.7269, 0.1889)
+};
+
+// Green's function at the critical point 0 of each seed's Julia set (0 when the set is connected),
+// worked out once by find_critical_green.
+static long double julia_critical_green[4];
+static pthread_once_t julia_critical_once = PTHREAD_ONCE_INIT;
+
+/* Number of entries in the fractal table, built-in ones included. */
+int fractal_count(void) {
+    return atomic_load_explicit(&num_fractals, memory_order_acquire);
+}
+
+/* Returns -1 and leaves buf alone if which_fractal is not in the table. */
+int fractal(ld_complex_t top, ld_complex_t bottom, int which_fractal, unsigned int seed, struct buffer_t *buf) {
+    if (which_fractal < 0 || which_fractal >= fractal_count()) {
+        return -1;
+    }
 
     // Depending on the seed, we choose a different type of fractal.
-    fractal_fn f = fractal_types[which_fractal % 3];
+    fractal_fn f = fractal_types[which_fractal];
     f(top, bottom, seed, buf);
+    return 0;
+}
+
+int fractal_symmetry(int which_fractal) {
+    if (which_fractal < 0 || which_fractal >= fractal_count()) {
+        return SYMMETRY_NONE;
+    }
+    return fractal_symmetries[which_fractal];
+}
+
+/*
+ * Adds a fractal to the table and returns its which_fractal index, or -1 if the table is full. This
+ * may be called while other threads render: the entry is written before the count that makes it
+ * visible is published.
+ */
+int register_fractal(fractal_fn f, int symmetry) {
+    pthread_mutex_lock(&registry_lock);
+    int index = atomic_load_explicit(&num_fractals, memory_order_relaxed);
+    if (index == MAX_FRACTALS) {
+        pthread_mutex_unlock(&registry_lock);
+        return -1;
+    }
+    fractal_types[index] = f;
+    fractal_symmetries[index] = symmetry;
+    atomic_store_explicit(&num_fractals, index + 1, memory_order_release);
+    pthread_mutex_unlock(&registry_lock);
+    return index;
 }
 
 /* outputs a colour given a number of iterations */
@@ -133,13 +210,7 @@ void ship(ld_complex_t top, ld_complex_t bottom, unsigned int seed, struct buffe
 
 void julia(ld_complex_t top, ld_complex_t bottom, unsigned int seed, struct buffer_t *buf) {
 
-    ld_complex_t vals[4] = {
-        CMPLXL(-0.8, 0.156),
-        CMPLXL(-0.4, 0.6),
-        CMPLXL(0.285, 0.01),
-        CMPLXL(-0.7269, 0.1889)
-    };
-    ld_complex_t c = vals[seed % 4];
+    ld_complex_t c = julia_seeds[seed % 4];
 
     long double step_w = (creall(bottom) - creall(top)) / buf->width;
     long double step_h = (cimagl(bottom) - cimagl(top)) / buf->height;
@@ -180,3 +251,142 @@ void mandelbrot(ld_complex_t top, ld_complex_t bottom, unsigned int seed, struct
     }
 }
 
+/* colours a pixel by its estimated distance to the set, both measured in the complex plane */
+SDL_Color get_distance_color(long double distance, long double pixel_size) {
+    static SDL_Color set = {0, 0, 0};
+    static SDL_Color background = {255, 244, 214};
+
+    if (distance < 0) {
+        return set;
+    }
+
+    float t = distance / (DE_SHADE_PIXELS * pixel_size);
+    t = (t > 1) ? 1 : t;
+
+    return lerp(set, background, sqrtf(t));
+}
+
+/*
+ * Escape-time loop for z -> z^2 + c that also carries the derivative dz of z with respect to the
+ * pixel coordinate. For the Mandelbrot set the pixel is c (dz starts at 0 and gains +1 each step),
+ * for Julia sets it is the starting z (dz starts at 1). Returns the exterior distance estimate
+ * 2|z|log|z|/|dz|, or -1 for points that never escaped. The Green's function log|z|/2^n at the
+ * pixel is stored in green if it escaped.
+ */
+static long double distance_estimate(ld_complex_t z, ld_complex_t c, ld_complex_t dz, int is_mandelbrot,
+                                      long double *green) {
+    unsigned int iteration = 0;
+    long double r2 = DE_ESCAPE_RADIUS * DE_ESCAPE_RADIUS;
+
+    while (iteration < MAX_ITERATIONS) {
+        long double zx = creall(z);
+        long double zy = cimagl(z);
+        if (zx*zx + zy*zy > r2) {
+            long double r = cabsl(z);
+            *green = logl(r) / ldexpl(1, iteration);
+            return 2 * r * logl(r) / cabsl(dz);
+        }
+        dz = 2 * z * dz + (is_mandelbrot ? 1 : 0);
+        z = z*z + c;
+        iteration++;
+    }
+
+    return -1;
+}
+
+/* A Julia set is connected exactly when the orbit of its critical point 0 stays bounded. */
+static void find_critical_green(void) {
+    for (unsigned int s = 0; s < 4; s++) {
+        ld_complex_t z = CMPLXL(0.0, 0.0);
+        unsigned int iteration = 0;
+        while (cabsl(z) <= DE_ESCAPE_RADIUS && iteration < CRITICAL_ITERATIONS) {
+            z = z*z + julia_seeds[s];
+            iteration++;
+        }
+        julia_critical_green[s] = (iteration == CRITICAL_ITERATIONS) ? 0 : logl(cabsl(z)) / ldexpl(1, iteration);
+    }
+}
+
+/*
+ * Radius of the disk around a pixel of a Julia set that is known to be background. The Böttcher map
+ * is univalent where G > G(0), so by Koebe it covers a disk of radius (1 - e^(G(0) - G)) / (4|∇G|)
+ * around the pixel, and |∇G| = 2G/d. Pixels at or below the level of the critical point get none.
+ */
+static long double julia_fill_radius(long double d, long double green, long double critical_green) {
+    if (green <= critical_green) {
+        return 0;
+    }
+    return -expm1l(critical_green - green) * d / (8 * green);
+}
+
+/*
+ * Shared driver for the distance-estimated fractals. The estimate d at a pixel is within a factor
+ * of four of the true distance to the set (Koebe 1/4 theorem), so a disk of radius d/4 around it
+ * cannot touch the set. Every pixel in that disk whose own estimate must still exceed the shading
+ * cutoff is painted as background straight away instead of being iterated.
+ *
+ * The bound needs the Green's function G to have no critical points, which holds everywhere outside
+ * the Mandelbrot set. Outside a disconnected Julia set it only holds above the level G(0) of the
+ * critical point, so there the disk shrinks with G - G(0) (see julia_fill_radius).
+ */
+static void distance_fractal(ld_complex_t top, ld_complex_t bottom, int is_mandelbrot, ld_complex_t julia_c,
+                             long double critical_green, struct buffer_t *buf) {
+
+    long double step_w = (creall(bottom) - creall(top)) / buf->width;
+    long double step_h = (cimagl(bottom) - cimagl(top)) / buf->height;
+    long double pixel_size = fminl(fabsl(step_w), fabsl(step_h));
+    long double cutoff = DE_SHADE_PIXELS * pixel_size;
+    SDL_Color background = get_distance_color(cutoff, pixel_size);
+
+    unsigned char *done = calloc(buf->width * buf->height, 1);
+    for (unsigned int i = 0; i < buf->width; i++) {
+        for (unsigned int j = 0; j < buf->height; j++) {
+            if (done[i + j * buf->width]) {
+                continue;
+            }
+
+            ld_complex_t p = top + CMPLXL(i * step_w, j * step_h);
+            long double green = 0;
+            long double d = is_mandelbrot
+                ? distance_estimate(CMPLXL(0.0, 0.0), p, CMPLXL(0.0, 0.0), 1, &green)
+                : distance_estimate(p, julia_c, CMPLXL(1.0, 0.0), 0, &green);
+
+            set_color(buf, i, j, get_distance_color(d, pixel_size));
+            done[i + j * buf->width] = 1;
+
+            // Radius (in the complex plane) of the disk around p that is guaranteed to be background.
+            long double radius = (is_mandelbrot ? d / 4 : julia_fill_radius(d, green, critical_green)) - cutoff;
+            if (d < 0 || radius < pixel_size) {
+                continue;
+            }
+
+            long double rx = radius / fabsl(step_w);
+            long double ry = radius / fabsl(step_h);
+            unsigned int x0 = (i > rx) ? i - (unsigned int) rx : 0;
+            unsigned int x1 = (i + rx < buf->width - 1) ? i + (unsigned int) rx : buf->width - 1;
+            unsigned int y0 = (j > ry) ? j - (unsigned int) ry : 0;
+            unsigned int y1 = (j + ry < buf->height - 1) ? j + (unsigned int) ry : buf->height - 1;
+            for (unsigned int x = x0; x <= x1; x++) {
+                for (unsigned int y = y0; y <= y1; y++) {
+                    long double dx = ((long double) x - i) * step_w;
+                    long double dy = ((long double) y - j) * step_h;
+                    if (!done[x + y * buf->width] && dx*dx + dy*dy <= radius*radius) {
+                        set_color(buf, x, y, background);
+                        done[x + y * buf->width] = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    free(done);
+}
+
+void mandelbrot_de(ld_complex_t top, ld_complex_t bottom, unsigned int seed, struct buffer_t *buf) {
+    distance_fractal(top, bottom, 1, CMPLXL(0.0, 0.0), 0, buf);
+}
+
+void julia_de(ld_complex_t top, ld_complex_t bottom, unsigned int seed, struct buffer_t *buf) {
+    pthread_once(&julia_critical_once, find_critical_green);
+    distance_fractal(top, bottom, 0, julia_seeds[seed % 4], julia_critical_green[seed % 4], buf);
+}
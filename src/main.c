@@ -1,47 +1,60 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <string.h>
 #include <time.h>
 #include <SDL2/SDL.h>
 
+#include "buddhabrot.h"
+#include "formula.h"
 #include "fractal.h"
 #include "pixel_ops.h"
-#include "pthread_pool.h"
+#include "render_ctx.h"
+#include "trace.h"
+#include "viewport.h"
 
-#define WINDOW_WIDTH 1600
-#define WINDOW_HEIGHT 1200
-
-#define HORIZONTAL_REGIONS 16
-#define VERTICAL_REGIONS 16
-
-/* Contains data to send to fractal workers. */
-struct worker_luggage_t {
-    ld_complex_t region_top;
-    ld_complex_t region_bot;
-    SDL_Rect region_pixel_geometry;
-};
-
-SDL_Surface *g_screen_surface;
-SDL_Surface *g_worker_surface;
-pthread_mutex_t g_worker_surface_lock = PTHREAD_MUTEX_INITIALIZER;
+// Orbits plotted per progressive Buddhabrot pass, and when to stop refining.
+#define BUDDHABROT_PASS_SAMPLES 1000000
+#define BUDDHABROT_MAX_PASSES 200
 
 /* Options that may be set by the user */
-int g_which_fractal = 0;
-unsigned int g_seed = 0;
+struct options_t {
+    int which_fractal;
+    unsigned int seed;
+    int buddhabrot_kind; // negative for escape-time fractals
+    char formula[256];   // empty unless the user typed in their own
+};
 
-/* This is a thread pool that will contain our workers. */
-void *g_pool;
+void draw_tile(struct render_ctx_t *ctx, SDL_Rect tile);
+void draw_buffer(SDL_Surface *surface, struct buffer_t *buf);
+void print_view(struct view_t *view, const SDL_Event *event);
+void save_screenshot(SDL_Surface *surface);
+void startup(struct options_t *options);
+
+int main(int argc, char **argv) {
+    const char *record_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            return replay_trace(argv[i + 1]);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else {
+            printf("Usage: %s [--record TRACE | --replay TRACE]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
 
-void draw_fractal(ld_complex_t viewport_top, ld_complex_t viewport_bot);
-void *fractal_worker(void *luggage_v);
-void change_viewport(int down_x, int down_y, int up_x, int up_y,
-                     ld_complex_t *viewport_top, ld_complex_t *viewport_bottom);
-void change_centre(int centre_x, int centre_y, ld_complex_t *viewport_top, ld_complex_t *viewport_bottom);
-void zoom(float factor, ld_complex_t *viewport_top, ld_complex_t *viewport_bottom);
-void startup();
+    struct options_t options = {0, 0, -1, ""};
+    startup(&options);
 
-int main() {
-    startup();
+    struct trace_t *trace = NULL;
+    if (record_path != NULL) {
+        trace = make_trace(record_path, options.which_fractal, options.seed, options.buddhabrot_kind,
+                           options.formula);
+        if (trace == NULL) {
+            printf("Could not open %s for recording.\n", record_path);
+            exit(EXIT_FAILURE);
+        }
+    }
 
     // Init SDL and stuff.
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
@@ -61,119 +74,94 @@ int main() {
         goto bail_window;
     }
 
-    // Set globals.
-    g_screen_surface = SDL_GetWindowSurface(window);
-    g_pool = pool_start(fractal_worker, HORIZONTAL_REGIONS * VERTICAL_REGIONS);
-    g_worker_surface = SDL_CreateRGBSurface(0,
-        WINDOW_WIDTH / HORIZONTAL_REGIONS, WINDOW_HEIGHT / VERTICAL_REGIONS,
-        32, 0, 0, 0, 0);
-
-    // This is the initial viewport. The viewport is like a window into the complex plane. It has
-    // a fixed shape but it is independant of the actual window (and window's surface) size. One
-    // major difference is that here the coordinate system is like in the complex plane (increasing y
-    // values go 'up') while the SDL coordinate system is different (increasing y go 'down').
-    ld_complex_t viewport_top = CMPLXL(-2.5, 1.0);
-    ld_complex_t viewport_bot = CMPLXL(1.0, -1.0);
+    SDL_Surface *screen_surface = SDL_GetWindowSurface(window);
+
+    // The engine holds the thread pool that will contain our workers. The window is one render job
+    // on it: each finished tile of the job is put on the screen as soon as it is done.
+    struct render_engine_t *engine = make_render_engine(HORIZONTAL_REGIONS * VERTICAL_REGIONS);
+    struct buffer_t *screen_buf = make_buffer(WINDOW_WIDTH, WINDOW_HEIGHT);
+    struct render_ctx_t *ctx = make_render_ctx(engine, options.which_fractal, options.seed, screen_buf);
+    ctx->priority = RENDER_PRIORITY_INTERACTIVE;
+    ctx->horizontal_regions = HORIZONTAL_REGIONS;
+    ctx->vertical_regions = VERTICAL_REGIONS;
+    ctx->on_tile = draw_tile;
+    ctx->user = screen_surface;
+
+    struct view_t view;
+    init_view(&view);
+
+    /* Orbit-density image being refined, if one was picked. It shares the engine's threads. */
+    struct buddhabrot_t *buddhabrot = NULL;
+    if (options.buddhabrot_kind >= 0) {
+        buddhabrot = make_buddhabrot(engine, options.buddhabrot_kind, view.top, view.bottom,
+                                     WINDOW_WIDTH, WINDOW_HEIGHT);
+        buddhabrot->priority = RENDER_PRIORITY_INTERACTIVE;
+    }
 
     SDL_Event event;
-    SDL_Surface *sshot;
-    int down_x, down_y;
-    int up_x, up_y;
-    int curr_x, curr_y;
-    int mouse_down = 0;
     static int dirty = 1;
     while (1) {
         // SDL_GetMouseState(&curr_x, &curr_y);
         // printf("Curr pos: %d %d\n", curr_x, curr_y);
 
         if (dirty) {
-            pool_wait(g_pool);
             /* Ooh, she be dirty */
             dirty = 0;
-            printf("Drawing fractal.\n");
-            draw_fractal(viewport_top, viewport_bot);
+            if (options.buddhabrot_kind < 0) {
+                // Tiles of the old viewport that haven't started are not worth drawing anymore.
+                render_cancel(ctx);
+                printf("Drawing fractal.\n");
+                render_submit(ctx, view.top, view.bottom);
+            } else {
+                // Start accumulating from scratch, the old orbits don't fit the new viewport.
+                buddhabrot_reset(buddhabrot, view.top, view.bottom);
+            }
+        }
+
+        // Refine the orbit-density image one pass per frame so events are still handled in between.
+        if (buddhabrot != NULL && buddhabrot->passes < BUDDHABROT_MAX_PASSES) {
+            buddhabrot_pass(buddhabrot, BUDDHABROT_PASS_SAMPLES);
+            draw_buffer(screen_surface, buddhabrot->buf);
+            if (buddhabrot->passes == BUDDHABROT_MAX_PASSES) {
+                printf("Done plotting %lu orbits.\n", buddhabrot->samples);
+            }
         }
 
         SDL_UpdateWindowSurface(window);
 
         if (SDL_PollEvent(&event)) {
+            if (trace != NULL) {
+                trace_record(trace, &event);
+            }
             switch (event.type) {
                 case SDL_QUIT:
                     goto exit_routine;
-                case SDL_MOUSEBUTTONDOWN:
-                    SDL_GetMouseState(&down_x, &down_y);
-                    break;
-                case SDL_MOUSEBUTTONUP:
-                    SDL_GetMouseState(&up_x, &up_y);
-                    printf("Mouse down: %d %d\n", down_x, down_y);
-                    printf("Mouse up: %d %d\n", up_x, up_y);
-                    change_viewport(down_x, down_y, up_x, up_y, &viewport_top, &viewport_bot);
-                    printf("Viewport top: %LG %LG\n", creall(viewport_top), cimagl(viewport_top));
-                    printf("Viewport bottom: %LG %LG\n", creall(viewport_bot), cimagl(viewport_bot));
-                    dirty = 1;
-                    break;
                 case SDL_KEYDOWN:
-                    switch (event.key.keysym.sym) {
-                        /* move by sending specially chosen boundaries to change_viewport */
-                        case SDLK_h:
-                        case SDLK_LEFT:
-                            change_centre(0, WINDOW_HEIGHT/2, &viewport_top, &viewport_bot);
-                            goto do_the_dirty;
-                        case SDLK_l:
-                        case SDLK_RIGHT:
-                            change_centre(WINDOW_WIDTH, WINDOW_HEIGHT/2, &viewport_top, &viewport_bot);
-                            goto do_the_dirty;
-                        case SDLK_k:
-                        case SDLK_UP:
-                            change_centre(WINDOW_WIDTH/2, 0, &viewport_top, &viewport_bot);
-                            goto do_the_dirty;
-                        case SDLK_j:
-                        case SDLK_DOWN:
-                            change_centre(WINDOW_WIDTH/2, WINDOW_HEIGHT, &viewport_top, &viewport_bot);
-                            goto do_the_dirty;
-                        case SDLK_SPACE: // zoom out
-                        case SDLK_n:
-                            zoom(2.0, &viewport_top, &viewport_bot);
-                            goto do_the_dirty;
-                        case SDLK_RETURN: // zoom in
-                        case SDLK_u:
-                            zoom(0.5, &viewport_top, &viewport_bot);
-                            goto do_the_dirty;
-                        case SDLK_s:   // screenshot
-                            SDL_LockSurface(g_screen_surface);
-                            unsigned char *pixels;
-                            SDL_PixelFormat *fmt = g_screen_surface->format;
-                            time_t now = time(0);
-                            struct tm *tstruct;
-                            tstruct = localtime(&now);
-                            char fname[80];
-                            strftime(fname, 80, "out/mattoni%Y-%m-%d-%H.%M.%S.bmp", tstruct);
-                        //    sshot = SDL_CreateRGBSurface(0, 32, 32, 32, 0, 0, 0, 0);
-                          //  SDL_FillRect(sshot, NULL, SDL_MapRGB(sshot->format, 0, 0, 255));
-                            sshot = SDL_CreateRGBSurfaceFrom(g_screen_surface->pixels, g_screen_surface->w,
-                                                             g_screen_surface->h, fmt->BitsPerPixel,
-                                                             g_screen_surface->pitch, 0,0,0,0);
-                            if (SDL_SaveBMP(sshot, fname) == 0) {
-                                printf("Saved screenshot to %s.\n", fname);
-                            } else {
-                                printf("Failed to save screenshot: %s\n", SDL_GetError());
-                            }
-                            SDL_UnlockSurface(g_screen_surface);
-                            break;
-                        default:
-                            break;
-                        do_the_dirty:
-                            dirty = 1;
-
+                    if (event.key.keysym.sym == SDLK_s) {
+                        save_screenshot(screen_surface);
+                        break;
+                    }
+                    // fall through to moving around
+                default:
+                    if (view_event(&view, &event)) {
+                        print_view(&view, &event);
+                        dirty = 1;
                     }
                     break;
-
             }
         }
     }
 
     exit_routine:
-    SDL_FreeSurface(g_worker_surface);
+    if (buddhabrot != NULL) {
+        free_buddhabrot(&buddhabrot);
+    }
+    free_render_ctx(&ctx);
+    free_render_engine(&engine);
+    free_buffer(&screen_buf);
+    if (trace != NULL) {
+        free_trace(&trace);
+    }
     SDL_DestroyWindow(window);
     bail_window:
     SDL_Quit;
@@ -181,155 +169,65 @@ int main() {
     return EXIT_SUCCESS;
 }
 
-void draw_fractal(ld_complex_t viewport_top, ld_complex_t viewport_bot) {
-
-    // Each region of the screen has a size as measured in the complex plane and a size in pixels.
-    // Both are needed but they are unrelated to each other, despite the very similar names.
-    long double region_w = (creall(viewport_bot) - creall(viewport_top)) / HORIZONTAL_REGIONS;
-    long double region_h = (cimagl(viewport_top) - cimagl(viewport_bot)) / VERTICAL_REGIONS;
-    size_t region_w_p = WINDOW_WIDTH / HORIZONTAL_REGIONS;
-    size_t region_h_p = WINDOW_HEIGHT / VERTICAL_REGIONS;
-
-    // For each region of the screen, create a fractal worker. Each worker will compute the part of
-    // the fractal living in the region of the screen it is assigned by putting colors into a buffer.
-    for (int i = 0; i < HORIZONTAL_REGIONS; i++) {
-        for (int j = 0; j < VERTICAL_REGIONS; j++) {
-
-            // The following lines are to compute the position of each region in PIXELS. This is
-            // for RENDERING and is not related to the actual computation of fractals.
-            unsigned int px = i * region_w_p;
-            unsigned int py = j * region_h_p;
-            SDL_Rect geometry = {px, py, region_w_p, region_h_p};
-
-            // Put all the info needed by each worker into a 'luggage'. No mem leak as pthread_pool
-            // will free everything once the task of a worker is done.
-            struct worker_luggage_t *luggage = malloc(sizeof (struct worker_luggage_t));
-            luggage->region_pixel_geometry = geometry;
-            luggage->region_top = viewport_top + CMPLXL(i * region_w, -j * region_h);
-            luggage->region_bot = viewport_top + CMPLXL((i+1) * region_w, -(j+1) * region_h);
-
-            // Send the task to the pool, let some worker take care of it (for free; I love slavery).
-            pool_enqueue(g_pool, (void *)luggage, 1);
-        }
+/* Saves a bitmap of the surface to the out folder. */
+void save_screenshot(SDL_Surface *surface) {
+    SDL_LockSurface(surface);
+    SDL_PixelFormat *fmt = surface->format;
+    time_t now = time(0);
+    struct tm *tstruct;
+    tstruct = localtime(&now);
+    char fname[80];
+    strftime(fname, 80, "out/mattoni%Y-%m-%d-%H.%M.%S.bmp", tstruct);
+    SDL_Surface *sshot = SDL_CreateRGBSurfaceFrom(surface->pixels, surface->w, surface->h,
+                                                  fmt->BitsPerPixel, surface->pitch, 0,0,0,0);
+    if (SDL_SaveBMP(sshot, fname) == 0) {
+        printf("Saved screenshot to %s.\n", fname);
+    } else {
+        printf("Failed to save screenshot: %s\n", SDL_GetError());
     }
-
-    // Wait until all workers are done rendering their part of the fractal.
-    //pool_wait(g_pool);
+    SDL_FreeSurface(sshot);
+    SDL_UnlockSurface(surface);
 }
 
-void *fractal_worker(void *luggage_v) {
-
-    // Need to cast the luggage into its real type. All this deal with void pointers and struct luggage
-    // is because a fractal worker can only receive one parameter, so we gotta bundle all the params
-    // we want to send into one big struct and also put it on the heap (no shared stack for threads!)
-    struct worker_luggage_t *luggage = (struct worker_luggage_t *)luggage_v;
+/* Puts a freshly rendered tile on the screen surface passed as the job's user data. */
+void draw_tile(struct render_ctx_t *ctx, SDL_Rect tile) {
+    SDL_Surface *surface = (SDL_Surface *)ctx->user;
+    struct buffer_t *buf = ctx->target;
 
-    // Unpack the luggage.
-    int px = luggage->region_pixel_geometry.x;
-    int py = luggage->region_pixel_geometry.y;
-    int pw = luggage->region_pixel_geometry.w;
-    int ph = luggage->region_pixel_geometry.h;
-
-    ld_complex_t region_top = luggage->region_top;
-    ld_complex_t region_bot = luggage->region_bot;
-
-    // This is the long computation part.
-    struct buffer_t *buf = make_buffer(pw, ph);
-    fractal(region_top, region_bot, g_which_fractal, g_seed, buf);
-
-    // Lock the global worker surface before copying the buffer on it because it is shared by all the threads.
-    pthread_mutex_lock(&g_worker_surface_lock);
-    for (int x = 0; x < pw; x++) {
-        for (int y = 0; y < ph; y++) {
-            SDL_Color col = buf->colors[x + y * pw];
-            set_pixel(g_worker_surface, x, y, SDL_MapRGB(g_worker_surface->format, col.r, col.g, col.b));
+    // Tiles never overlap so workers can all write to the surface at once.
+    for (int x = tile.x; x < tile.x + tile.w; x++) {
+        for (int y = tile.y; y < tile.y + tile.h; y++) {
+            SDL_Color col = buf->colors[x + y * buf->width];
+            set_pixel(surface, x, y, SDL_MapRGB(surface->format, col.r, col.g, col.b));
         }
     }
-    SDL_BlitSurface(g_worker_surface, NULL, g_screen_surface, &luggage->region_pixel_geometry);
-    pthread_mutex_unlock(&g_worker_surface_lock);
-
-    free(buf);
-    return NULL;
-}
-
-void change_viewport(int down_x, int down_y, int up_x, int up_y,
-                     ld_complex_t *viewport_top, ld_complex_t *viewport_bottom) {
-    int top_x = (down_x < up_x) ? down_x : up_x;
-    int top_y = (down_y < up_y) ? down_y : up_y;
-    int bottom_x = (down_x < up_x) ? up_x : down_x;
-    int bottom_y = (down_y < up_y) ? up_y : down_y;
-
-    int centre_x = (top_x + bottom_x) / 2;
-    int centre_y = (top_y + bottom_y) / 2;
-
-    float factor = (float) (bottom_x - top_x) / WINDOW_HEIGHT;
-    factor = (factor < 0.06) ? 0.06 : factor;
-
-    long double real_width = (creall(*viewport_bottom) - creall(*viewport_top));
-    long double imag_height = (cimagl(*viewport_bottom) - cimagl(*viewport_top));
-
-    printf("New width: %LG. New height: %LG.\n", real_width, imag_height);
-
-    long double real_offset = ((long double) centre_x / WINDOW_WIDTH)*real_width;
-    long double imag_offset = ((long double) centre_y / WINDOW_HEIGHT)*imag_height;
-
-    long double new_centre_real = real_offset + creall(*viewport_top);
-    long double new_centre_imag = imag_offset + cimagl(*viewport_top);
-
-    printf("Centre: %LG %LG\n", new_centre_real, new_centre_imag);
-
-    long double new_top_real = new_centre_real - factor*real_width/2;
-    long double new_top_imag = new_centre_imag - factor*imag_height/2;
-    long double new_bottom_real = new_centre_real + factor*real_width/2;
-    long double new_bottom_imag = new_centre_imag + factor*imag_height/2;
-
-    *viewport_top = CMPLXL(new_top_real, new_top_imag);
-    *viewport_bottom = CMPLXL(new_bottom_real, new_bottom_imag);
 }
 
-void change_centre(int centre_x, int centre_y, ld_complex_t *viewport_top, ld_complex_t *viewport_bottom) {
-    /* copy-paste from above ... I'm not proud */
-    long double real_width = (creall(*viewport_bottom) - creall(*viewport_top));
-    long double imag_height = (cimagl(*viewport_bottom) - cimagl(*viewport_top));
-
-    long double real_offset = ((long double) centre_x / WINDOW_WIDTH)*real_width;
-    long double imag_offset = ((long double) centre_y / WINDOW_HEIGHT)*imag_height;
-
-    long double new_centre_real = real_offset + creall(*viewport_top);
-    long double new_centre_imag = imag_offset + cimagl(*viewport_top);
-
-    printf("Centre: %LG %LG\n", new_centre_real, new_centre_imag);
-
-    long double new_top_real = new_centre_real - real_width/2;
-    long double new_top_imag = new_centre_imag - imag_height/2;
-    long double new_bottom_real = new_centre_real + real_width/2;
-    long double new_bottom_imag = new_centre_imag + imag_height/2;
-
-    *viewport_top = CMPLXL(new_top_real, new_top_imag);
-    *viewport_bottom = CMPLXL(new_bottom_real, new_bottom_imag);
+/* Copies a whole-screen buffer onto the screen surface. */
+void draw_buffer(SDL_Surface *surface, struct buffer_t *buf) {
+    for (int x = 0; x < buf->width; x++) {
+        for (int y = 0; y < buf->height; y++) {
+            SDL_Color col = buf->colors[x + y * buf->width];
+            set_pixel(surface, x, y, SDL_MapRGB(surface->format, col.r, col.g, col.b));
+        }
+    }
 }
 
-void zoom(float factor, ld_complex_t *viewport_top, ld_complex_t *viewport_bottom) {
-    long double real_width = (creall(*viewport_bottom) - creall(*viewport_top));
-    long double imag_height = (cimagl(*viewport_bottom) - cimagl(*viewport_top));
-
+/* Reports where an event has moved the viewport. */
+void print_view(struct view_t *view, const SDL_Event *event) {
+    if (event->type == SDL_MOUSEBUTTONUP) {
+        printf("Mouse down: %d %d\n", view->down_x, view->down_y);
+        printf("Mouse up: %d %d\n", event->button.x, event->button.y);
+    }
+    long double real_width = creall(view->bottom) - creall(view->top);
+    long double imag_height = cimagl(view->bottom) - cimagl(view->top);
     printf("New width: %LG. New height: %LG.\n", real_width, imag_height);
-
-    long double centre_real = creall(*viewport_top) + real_width/2;
-    long double centre_imag = cimagl(*viewport_top) + imag_height/2;
-
-    printf("Centre: %LG %LG\n", centre_real, centre_imag);
-
-    long double new_top_real = centre_real - factor*real_width/2;
-    long double new_top_imag = centre_imag - factor*imag_height/2;
-    long double new_bottom_real = centre_real + factor*real_width/2;
-    long double new_bottom_imag = centre_imag + factor*imag_height/2;
-
-    *viewport_top = CMPLXL(new_top_real, new_top_imag);
-    *viewport_bottom = CMPLXL(new_bottom_real, new_bottom_imag);
+    printf("Centre: %LG %LG\n", creall(view->top) + real_width/2, cimagl(view->top) + imag_height/2);
+    printf("Viewport top: %LG %LG\n", creall(view->top), cimagl(view->top));
+    printf("Viewport bottom: %LG %LG\n", creall(view->bottom), cimagl(view->bottom));
 }
 
-void startup() {
+void startup(struct options_t *options) {
     printf("Welcome to Mattoni, the People's Fractal Generator!\n");
     char buffer1[50];
     char buffer2[50];
@@ -340,21 +238,50 @@ void startup() {
         printf("1) Draw the Mandelbrot set\n");
         printf("2) Draw a Julia set\n");
         printf("3) Draw the burning ship fractal\n");
+        printf("4) Draw the Mandelbrot set by distance estimation\n");
+        printf("5) Draw a Julia set by distance estimation\n");
+        printf("6) Draw the Buddhabrot\n");
+        printf("7) Draw the anti-Buddhabrot\n");
+        printf("8) Draw the Nebulabrot\n");
+        printf("9) Draw your own formula\n");
         scanf("%s", buffer1);
         switch (buffer1[0]) {
             case '2':
-                g_which_fractal = 1;
+            case '5':
+                options->which_fractal = buffer1[0] - '1';
                 printf("Enter an integer seed: ");
                 scanf("%s", buffer2);
-                g_seed = (unsigned int) (buffer2[0] - '0');
-                printf("%u\n", g_seed);
+                options->seed = (unsigned int) (buffer2[0] - '0');
+                printf("%u\n", options->seed);
                 running = 0;
                 break;
             case '1':
             case '3':
-                g_which_fractal = buffer1[0] - '1';
+            case '4':
+                options->which_fractal = buffer1[0] - '1';
+                running = 0;
+                break;
+            case '6':
+            case '7':
+            case '8':
+                options->buddhabrot_kind = buffer1[0] - '6';
                 running = 0;
                 break;
+            case '9':
+                while ( (c = getchar()) != '\n' && c != EOF ) { }
+                printf("Enter an iteration formula in z and c, such as z^3 + c*sin(z): ");
+                if (fgets(options->formula, sizeof options->formula, stdin) == NULL) {
+                    exit(EXIT_FAILURE);
+                }
+                options->formula[strcspn(options->formula, "\n")] = '\0';
+                options->which_fractal = compile_formula(options->formula);
+                running = (options->which_fractal < 0);
+                if (running) {
+                    // Forget it, or a trace would still name it if another fractal is picked.
+                    options->formula[0] = '\0';
+                    options->which_fractal = 0;
+                }
+                continue; // the whole line has been read already
             default:
                 printf("Invalid option.\n");
                 continue;
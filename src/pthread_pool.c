@@ -6,6 +6,7 @@
 struct pool_queue {
 	void *arg;
 	char free;
+	int priority;
 	struct pool_queue *next;
 };
 
@@ -44,16 +45,34 @@ void * pool_start(void * (*thread_func)(void *), unsigned int threads) {
 }
 
 void pool_enqueue(void *pool, void *arg, char free) {
+	pool_enqueue_priority(pool, arg, free, 0);
+}
+
+void pool_enqueue_priority(void *pool, void *arg, char free, int priority) {
 	struct pool *p = (struct pool *) pool;
 	struct pool_queue *q = (struct pool_queue *) malloc(sizeof(struct pool_queue));
+	struct pool_queue *prev;
 	q->arg = arg;
 	q->next = NULL;
 	q->free = free;
+	q->priority = priority;
 
 	pthread_mutex_lock(&p->q_mtx);
-	if (p->end != NULL) p->end->next = q;
-	if (p->q == NULL) p->q = q;
-	p->end = q;
+	if (p->end == NULL || p->end->priority >= priority) {
+		/* common case: append */
+		if (p->end != NULL) p->end->next = q;
+		if (p->q == NULL) p->q = q;
+		p->end = q;
+	} else if (p->q->priority < priority) {
+		q->next = p->q;
+		p->q = q;
+	} else {
+		/* insert after the last task of the same or higher priority */
+		prev = p->q;
+		while (prev->next->priority >= priority) prev = prev->next;
+		q->next = prev->next;
+		prev->next = q;
+	}
 	p->remaining++;
 	pthread_cond_signal(&p->q_cnd);
 	pthread_mutex_unlock(&p->q_mtx);
@@ -0,0 +1,359 @@
+/* Reentrant render contexts sharing one thread pool */
+
+#include <complex.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fractal.h"
+#include "pthread_pool.h"
+#include "render_ctx.h"
+
+#define DEFAULT_REGIONS 16
+
+// How far (in pixels) the symmetry axis may be from the pixel grid for mirroring to still be used.
+#define MIRROR_TOLERANCE 1e-3
+
+/* Contains data to send to tile workers. */
+struct tile_luggage_t {
+    struct engine_task_t task;
+    struct render_ctx_t *ctx;
+    ld_complex_t region_top;
+    ld_complex_t region_bot;
+    SDL_Rect region_pixel_geometry;
+};
+
+static void *engine_worker(void *task_v);
+static void tile_worker(struct engine_task_t *task);
+static void find_mirror(struct render_ctx_t *ctx, ld_complex_t viewport_top, long double pixel_w, long double pixel_h);
+static unsigned int cut_around(SDL_Rect tile, SDL_Rect hole, SDL_Rect *pieces);
+static SDL_Rect region_geometry(struct render_ctx_t *ctx, unsigned int i, unsigned int j);
+static void fill_mirror(struct render_ctx_t *ctx);
+
+/* Overlap of two rectangles, returns 0 if they don't overlap. */
+static int intersect(SDL_Rect a, SDL_Rect b, SDL_Rect *out) {
+    int x0 = (a.x > b.x) ? a.x : b.x;
+    int y0 = (a.y > b.y) ? a.y : b.y;
+    int x1 = (a.x + a.w < b.x + b.w) ? a.x + a.w : b.x + b.w;
+    int y1 = (a.y + a.h < b.y + b.h) ? a.y + a.h : b.y + b.h;
+    if (x0 >= x1 || y0 >= y1) {
+        return 0;
+    }
+    SDL_Rect overlap = {x0, y0, x1 - x0, y1 - y0};
+    *out = overlap;
+    return 1;
+}
+
+struct render_engine_t *make_render_engine(unsigned int threads) {
+    struct render_engine_t *engine = (struct render_engine_t *)malloc(sizeof(struct render_engine_t));
+    engine->threads = threads;
+    engine->pool = pool_start(engine_worker, threads);
+    return engine;
+}
+
+/* Queues any task on the engine's threads, ahead of queued tasks with a lower priority. */
+void engine_enqueue(struct render_engine_t *engine, struct engine_task_t *task, int priority) {
+    pool_enqueue_priority(engine->pool, (void *)task, 1, priority);
+}
+
+static void *engine_worker(void *task_v) {
+    struct engine_task_t *task = (struct engine_task_t *)task_v;
+    task->run(task);
+    return NULL;
+}
+
+/* Every context using the engine must have been freed first. */
+void free_render_engine(struct render_engine_t **engine) {
+    pool_end((*engine)->pool);
+    free(*engine);
+    *engine = NULL;
+}
+
+struct render_ctx_t *make_render_ctx(struct render_engine_t *engine, int which_fractal, unsigned int seed,
+                                     struct buffer_t *target) {
+    struct render_ctx_t *ctx = (struct render_ctx_t *)calloc(1, sizeof(struct render_ctx_t));
+    ctx->engine = engine;
+    ctx->which_fractal = which_fractal;
+    ctx->seed = seed;
+    ctx->target = target;
+    ctx->priority = RENDER_PRIORITY_BATCH;
+    ctx->horizontal_regions = DEFAULT_REGIONS;
+    ctx->vertical_regions = DEFAULT_REGIONS;
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->finished, NULL);
+    return ctx;
+}
+
+/* Cancels whatever is still queued and waits for running tiles before freeing. */
+void free_render_ctx(struct render_ctx_t **ctx) {
+    render_cancel(*ctx);
+    render_wait(*ctx);
+    pthread_mutex_destroy(&(*ctx)->lock);
+    pthread_cond_destroy(&(*ctx)->finished);
+    free(*ctx);
+    *ctx = NULL;
+}
+
+/*
+ * Starts rendering the viewport into ctx->target. If the context is still busy with an earlier
+ * job, this waits for it first, so cancel it beforehand to replace it quickly. A context with zero
+ * horizontal or vertical regions, or an unknown which_fractal, renders nothing and its on_done is
+ * called before this returns.
+ */
+void render_submit(struct render_ctx_t *ctx, ld_complex_t viewport_top, ld_complex_t viewport_bot) {
+    render_wait(ctx);
+
+    size_t width = ctx->target->width;
+    size_t height = ctx->target->height;
+    unsigned int hr = ctx->horizontal_regions;
+    unsigned int vr = ctx->vertical_regions;
+
+    // Size of one pixel in the complex plane. Tiles may differ by a pixel when the target size is
+    // not a multiple of the region count, but they all sample the same pixel grid.
+    long double pixel_w = (creall(viewport_bot) - creall(viewport_top)) / width;
+    long double pixel_h = (cimagl(viewport_top) - cimagl(viewport_bot)) / height;
+
+    // Formulas may be registered concurrently, so the index is checked against the table as it is now.
+    int known = (ctx->which_fractal >= 0 && ctx->which_fractal < fractal_count());
+    if (!known) {
+        printf("There is no fractal %d to render.\n", ctx->which_fractal);
+    }
+
+    // Cut every region of the screen around the mirrored pixels; the pieces left are computed.
+    find_mirror(ctx, viewport_top, pixel_w, pixel_h);
+    SDL_Rect *pieces = malloc(sizeof(SDL_Rect) * 4 * hr * vr);
+    unsigned int count = 0;
+    for (unsigned int i = 0; known && i < hr; i++) {
+        for (unsigned int j = 0; j < vr; j++) {
+            count += cut_around(region_geometry(ctx, i, j), ctx->mirror, &pieces[count]);
+        }
+    }
+
+    // The count has to be known before any tile can finish and check whether it was the last one.
+    pthread_mutex_lock(&ctx->lock);
+    ctx->tiles = count;
+    ctx->tiles_done = 0;
+    ctx->tiles_cancelled = 0;
+    ctx->cancelled = 0;
+    ctx->busy = (count > 0);
+    pthread_mutex_unlock(&ctx->lock);
+
+    // With no tiles there is no worker that could end the job, so it ends right here.
+    if (count == 0) {
+        free(pieces);
+        if (ctx->on_done != NULL) {
+            ctx->on_done(ctx);
+        }
+        return;
+    }
+
+    for (unsigned int k = 0; k < count; k++) {
+        SDL_Rect geometry = pieces[k];
+
+        // Put all the info needed by each worker into a 'luggage'. No mem leak as pthread_pool
+        // will free everything once the task of a worker is done.
+        struct tile_luggage_t *luggage = malloc(sizeof (struct tile_luggage_t));
+        luggage->task.run = tile_worker;
+        luggage->ctx = ctx;
+        luggage->region_pixel_geometry = geometry;
+        luggage->region_top = viewport_top
+            + CMPLXL(geometry.x * pixel_w, -(long double) geometry.y * pixel_h);
+        luggage->region_bot = viewport_top
+            + CMPLXL((geometry.x + geometry.w) * pixel_w, -(long double) (geometry.y + geometry.h) * pixel_h);
+
+        // Higher priority jobs jump the queue ahead of tiles from other jobs.
+        engine_enqueue(ctx->engine, &luggage->task, ctx->priority);
+    }
+
+    free(pieces);
+}
+
+/* Pixel geometry of region (i, j) of the target. */
+static SDL_Rect region_geometry(struct render_ctx_t *ctx, unsigned int i, unsigned int j) {
+    size_t width = ctx->target->width;
+    size_t height = ctx->target->height;
+    unsigned int hr = ctx->horizontal_regions;
+    unsigned int vr = ctx->vertical_regions;
+
+    unsigned int px = i * width / hr;
+    unsigned int py = j * height / vr;
+    SDL_Rect geometry = {px, py, (i + 1) * width / hr - px, (j + 1) * height / vr - py};
+    return geometry;
+}
+
+/* Finds the nearest grid line to an axis position k measured in pixels, if it is close enough. */
+static int on_grid(long double k, long *grid) {
+    long double nearest = roundl(k);
+    if (fabsl(k - nearest) > MIRROR_TOLERANCE) {
+        return 0;
+    }
+    *grid = (long) nearest;
+    return 1;
+}
+
+/*
+ * Works out which pixels of the target are exact images of other pixels under the symmetry of the
+ * fractal. Pixel row y samples im(top) - y * pixel_h, so its mirror about the real axis is row
+ * ky - y with ky = 2 im(top) / pixel_h; likewise column x turns into kx - x with
+ * kx = -2 re(top) / pixel_w. Rows past ky / 2 whose image is still on screen are mirrored (for a
+ * half turn, only where the image column is on screen too). The result is a single rectangle.
+ */
+static void find_mirror(struct render_ctx_t *ctx, ld_complex_t viewport_top, long double pixel_w, long double pixel_h) {
+    long width = ctx->target->width;
+    long height = ctx->target->height;
+    SDL_Rect none = {0, 0, 0, 0};
+
+    ctx->symmetry = fractal_symmetry(ctx->which_fractal);
+    ctx->mirror = none;
+    if (ctx->symmetry == SYMMETRY_NONE || !on_grid(2 * cimagl(viewport_top) / pixel_h, &ctx->mirror_ky)) {
+        return;
+    }
+
+    long first_row = (ctx->mirror_ky < 0) ? height : ctx->mirror_ky / 2 + 1;
+    long last_row = (ctx->mirror_ky < height - 1) ? ctx->mirror_ky : height - 1;
+    long first_col = 0;
+    long last_col = width - 1;
+    if (ctx->symmetry == SYMMETRY_ROTATION) {
+        if (!on_grid(-2 * creall(viewport_top) / pixel_w, &ctx->mirror_kx)) {
+            return;
+        }
+        first_col = (ctx->mirror_kx - width + 1 > 0) ? ctx->mirror_kx - width + 1 : 0;
+        last_col = (ctx->mirror_kx < width - 1) ? ctx->mirror_kx : width - 1;
+    }
+
+    if (first_row <= last_row && first_col <= last_col) {
+        SDL_Rect mirror = {first_col, first_row, last_col - first_col + 1, last_row - first_row + 1};
+        ctx->mirror = mirror;
+    }
+}
+
+/* Splits tile minus hole into at most four rectangles, returns how many are not empty. */
+static unsigned int cut_around(SDL_Rect tile, SDL_Rect hole, SDL_Rect *pieces) {
+    SDL_Rect overlap;
+    if (!intersect(tile, hole, &overlap)) {
+        pieces[0] = tile;
+        return 1;
+    }
+
+    SDL_Rect candidates[4] = {
+        {tile.x, tile.y, tile.w, overlap.y - tile.y},                                          // above
+        {tile.x, overlap.y + overlap.h, tile.w, tile.y + tile.h - overlap.y - overlap.h},      // below
+        {tile.x, overlap.y, overlap.x - tile.x, overlap.h},                                    // left
+        {overlap.x + overlap.w, overlap.y, tile.x + tile.w - overlap.x - overlap.w, overlap.h} // right
+    };
+
+    unsigned int count = 0;
+    for (int k = 0; k < 4; k++) {
+        if (candidates[k].w > 0 && candidates[k].h > 0) {
+            pieces[count++] = candidates[k];
+        }
+    }
+    return count;
+}
+
+/* Copies every mirrored pixel from its image, once all the computed tiles are in. */
+static void fill_mirror(struct render_ctx_t *ctx) {
+    struct buffer_t *buf = ctx->target;
+    SDL_Rect m = ctx->mirror;
+
+    for (int y = m.y; y < m.y + m.h; y++) {
+        SDL_Color *row = &buf->colors[y * buf->width];
+        SDL_Color *image = &buf->colors[(ctx->mirror_ky - y) * buf->width];
+        if (ctx->symmetry == SYMMETRY_CONJUGATE) {
+            memcpy(&row[m.x], &image[m.x], sizeof(SDL_Color) * m.w);
+        } else {
+            for (int x = m.x; x < m.x + m.w; x++) {
+                row[x] = image[ctx->mirror_kx - x];
+            }
+        }
+    }
+
+    // Report the mirrored part of every region like any other finished tile.
+    if (ctx->on_tile != NULL) {
+        for (unsigned int i = 0; i < ctx->horizontal_regions; i++) {
+            for (unsigned int j = 0; j < ctx->vertical_regions; j++) {
+                SDL_Rect overlap;
+                if (intersect(region_geometry(ctx, i, j), m, &overlap)) {
+                    ctx->on_tile(ctx, overlap);
+                }
+            }
+        }
+    }
+}
+
+/* Tiles that have not started yet are skipped; running tiles still finish. */
+void render_cancel(struct render_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    ctx->cancelled = 1;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+void render_wait(struct render_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    while (ctx->busy) {
+        pthread_cond_wait(&ctx->finished, &ctx->lock);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+int render_finished(struct render_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    int finished = !ctx->busy;
+    pthread_mutex_unlock(&ctx->lock);
+    return finished;
+}
+
+static void tile_worker(struct engine_task_t *task) {
+    struct tile_luggage_t *luggage = (struct tile_luggage_t *)task;
+    struct render_ctx_t *ctx = luggage->ctx;
+    SDL_Rect geometry = luggage->region_pixel_geometry;
+
+    pthread_mutex_lock(&ctx->lock);
+    int cancelled = ctx->cancelled;
+    pthread_mutex_unlock(&ctx->lock);
+
+    if (!cancelled) {
+        // This is the long computation part.
+        struct buffer_t *buf = make_buffer(geometry.w, geometry.h);
+        fractal(luggage->region_top, luggage->region_bot, ctx->which_fractal, ctx->seed, buf);
+
+        // Tiles never overlap, so they can be copied into the target without locking.
+        for (int y = 0; y < geometry.h; y++) {
+            memcpy(&ctx->target->colors[geometry.x + (y + geometry.y) * ctx->target->width],
+                   &buf->colors[y * geometry.w], sizeof(SDL_Color) * geometry.w);
+        }
+        free_buffer(&buf);
+
+        if (ctx->on_tile != NULL) {
+            ctx->on_tile(ctx, geometry);
+        }
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    if (cancelled) {
+        ctx->tiles_cancelled++;
+    } else {
+        ctx->tiles_done++;
+    }
+    int last = (ctx->tiles_done + ctx->tiles_cancelled == ctx->tiles);
+    int complete = (ctx->tiles_cancelled == 0);
+    pthread_mutex_unlock(&ctx->lock);
+
+    // Every image of the mirrored pixels is in the target only if no tile was skipped.
+    if (last && complete && ctx->mirror.w > 0) {
+        fill_mirror(ctx);
+    }
+
+    if (last && ctx->on_done != NULL) {
+        ctx->on_done(ctx);
+    }
+
+    // Only now is the job over, so that render_wait guarantees the callbacks have returned.
+    if (last) {
+        pthread_mutex_lock(&ctx->lock);
+        ctx->busy = 0;
+        pthread_cond_broadcast(&ctx->finished);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+}
@@ -0,0 +1,309 @@
+/* Input-trace recording and headless replay */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buddhabrot.h"
+#include "formula.h"
+#include "fractal.h"
+#include "render_ctx.h"
+#include "trace.h"
+#include "viewport.h"
+
+/*
+ * A trace is a text file. The first line holds the options picked at startup, then every input
+ * event that may move the viewport gets one line, stamped with SDL's milliseconds since startup:
+ *
+ *     mattoni-trace <which_fractal> <seed> <buddhabrot_kind>
+ *     formula <formula>          (only for user-defined formulas)
+ *     <ms> down <x> <y>
+ *     <ms> up <x> <y>
+ *     <ms> key <sym>
+ *     <ms> quit
+ */
+#define TRACE_MAGIC "mattoni-trace"
+
+/* Timings of the render started by one interaction, in seconds since the replay started. */
+struct interaction_t {
+    double start;
+    double first_pixel;      // 0 until the first tile is in
+    double complete;         // 0 unless the render finished without being cancelled
+    unsigned int tiles_cancelled;
+};
+
+/* Shared with the tile callbacks of the replay job. */
+struct replay_t {
+    struct timespec epoch;
+    struct interaction_t *current;
+    pthread_mutex_t lock;
+};
+
+struct trace_t *make_trace(const char *path, int which_fractal, unsigned int seed, int buddhabrot_kind,
+                           const char *formula) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return NULL;
+    }
+    fprintf(file, "%s %d %u %d\n", TRACE_MAGIC, which_fractal, seed, buddhabrot_kind);
+    if (formula != NULL && formula[0] != '\0') {
+        fprintf(file, "formula %s\n", formula);
+    }
+
+    struct trace_t *trace = (struct trace_t *)malloc(sizeof(struct trace_t));
+    trace->file = file;
+    return trace;
+}
+
+void trace_record(struct trace_t *trace, const SDL_Event *event) {
+    switch (event->type) {
+        case SDL_MOUSEBUTTONDOWN:
+            fprintf(trace->file, "%u down %d %d\n", event->common.timestamp, event->button.x, event->button.y);
+            break;
+        case SDL_MOUSEBUTTONUP:
+            fprintf(trace->file, "%u up %d %d\n", event->common.timestamp, event->button.x, event->button.y);
+            break;
+        case SDL_KEYDOWN:
+            fprintf(trace->file, "%u key %d\n", event->common.timestamp, (int) event->key.keysym.sym);
+            break;
+        case SDL_QUIT:
+            fprintf(trace->file, "%u quit\n", event->common.timestamp);
+            break;
+        default:
+            break;
+    }
+}
+
+void free_trace(struct trace_t **trace) {
+    fclose((*trace)->file);
+    free(*trace);
+    *trace = NULL;
+}
+
+static double seconds_since(struct timespec *epoch) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - epoch->tv_sec) + (now.tv_nsec - epoch->tv_nsec) * 1e-9;
+}
+
+static void replay_tile(struct render_ctx_t *ctx, SDL_Rect tile) {
+    struct replay_t *replay = (struct replay_t *)ctx->user;
+    pthread_mutex_lock(&replay->lock);
+    if (replay->current->first_pixel == 0) {
+        replay->current->first_pixel = seconds_since(&replay->epoch);
+    }
+    pthread_mutex_unlock(&replay->lock);
+}
+
+static void replay_done(struct render_ctx_t *ctx) {
+    struct replay_t *replay = (struct replay_t *)ctx->user;
+    pthread_mutex_lock(&replay->lock);
+    if (ctx->tiles_cancelled == 0) {
+        replay->current->complete = seconds_since(&replay->epoch);
+    }
+    pthread_mutex_unlock(&replay->lock);
+}
+
+/* Reads the next event of a trace into event, returns 0 at the end of the trace. */
+static int read_event(FILE *file, SDL_Event *event) {
+    char kind[16];
+    unsigned int timestamp;
+
+    while (fscanf(file, "%u %15s", &timestamp, kind) == 2) {
+        memset(event, 0, sizeof(SDL_Event));
+        event->common.timestamp = timestamp;
+        if (strcmp(kind, "down") == 0 || strcmp(kind, "up") == 0) {
+            event->type = (kind[0] == 'd') ? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+            event->button.timestamp = timestamp;
+            if (fscanf(file, "%d %d", &event->button.x, &event->button.y) == 2) {
+                return 1;
+            }
+        } else if (strcmp(kind, "key") == 0) {
+            int sym;
+            event->type = SDL_KEYDOWN;
+            event->key.timestamp = timestamp;
+            if (fscanf(file, "%d", &sym) == 1) {
+                event->key.keysym.sym = sym;
+                return 1;
+            }
+        } else if (strcmp(kind, "quit") == 0) {
+            event->type = SDL_QUIT;
+            return 1;
+        }
+        printf("Skipping malformed trace line.\n");
+    }
+    return 0;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Prints nearest-rank percentiles of n latencies, in milliseconds. Sorts them in place. */
+static void print_percentiles(const char *name, double *latencies, unsigned int n) {
+    if (n == 0) {
+        printf("%-20s no samples\n", name);
+        return;
+    }
+    qsort(latencies, n, sizeof(double), compare_doubles);
+    static int ranks[4] = {50, 90, 99, 100};
+    static const char *labels[4] = {"p50", "p90", "p99", "max"};
+    printf("%-20s", name);
+    for (int r = 0; r < 4; r++) {
+        unsigned int k = (ranks[r] * n + 99) / 100;
+        printf("  %s %8.2f ms", labels[r], latencies[(k > 0 ? k : 1) - 1] * 1000);
+    }
+    printf("\n");
+}
+
+/*
+ * Replays a recorded trace without a window. Events are applied at the pace they were recorded,
+ * through the same viewport code as the interactive loop, and every viewport change cancels the
+ * render in flight and starts a new one exactly like main() does. Prints latency percentiles
+ * measured from each interaction to its first tile and to its finished frame.
+ */
+int replay_trace(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Could not open trace %s.\n", path);
+        return EXIT_FAILURE;
+    }
+
+    char magic[32];
+    int which_fractal, buddhabrot_kind;
+    unsigned int seed;
+    if (fscanf(file, "%31s %d %u %d", magic, &which_fractal, &seed, &buddhabrot_kind) != 4
+        || strcmp(magic, TRACE_MAGIC) != 0) {
+        printf("%s is not a Mattoni trace.\n", path);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    // A user-defined formula gets whatever index it is registered under in this run.
+    char line[300];
+    fgets(line, sizeof line, file);  // rest of the header
+    long events = ftell(file);
+    if (fgets(line, sizeof line, file) != NULL && strncmp(line, "formula ", 8) == 0) {
+        line[strcspn(line, "\n")] = '\0';
+        which_fractal = compile_formula(line + 8);
+        if (which_fractal < 0) {
+            fclose(file);
+            return EXIT_FAILURE;
+        }
+    } else {
+        fseek(file, events, SEEK_SET);
+        if (which_fractal < 0 || which_fractal >= NUM_BUILTIN_FRACTALS) {
+            printf("%s asks for fractal %d, which doesn't exist.\n", path, which_fractal);
+            fclose(file);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (buddhabrot_kind < -1 || buddhabrot_kind > NEBULABROT) {
+        printf("%s asks for orbit-density kind %d, which doesn't exist.\n", path, buddhabrot_kind);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+    if (buddhabrot_kind >= 0) {
+        printf("Replaying orbit-density renders is not supported.\n");
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    struct replay_t replay;
+    pthread_mutex_init(&replay.lock, NULL);
+    unsigned int capacity = 64;
+    unsigned int count = 0;
+    struct interaction_t *interactions = malloc(sizeof(struct interaction_t) * capacity);
+
+    struct render_engine_t *engine = make_render_engine(HORIZONTAL_REGIONS * VERTICAL_REGIONS);
+    struct buffer_t *buf = make_buffer(WINDOW_WIDTH, WINDOW_HEIGHT);
+    struct render_ctx_t *ctx = make_render_ctx(engine, which_fractal, seed, buf);
+    ctx->priority = RENDER_PRIORITY_INTERACTIVE;
+    ctx->horizontal_regions = HORIZONTAL_REGIONS;
+    ctx->vertical_regions = VERTICAL_REGIONS;
+    ctx->on_tile = replay_tile;
+    ctx->on_done = replay_done;
+    ctx->user = &replay;
+
+    struct view_t view;
+    init_view(&view);
+
+    clock_gettime(CLOCK_MONOTONIC, &replay.epoch);
+    SDL_Event event;
+    int dirty = 1;    // the first frame counts as an interaction too
+    int more = 1;
+    while (more) {
+        if (dirty) {
+            dirty = 0;
+            double start = seconds_since(&replay.epoch);
+
+            // Same as the interactive loop, but the wait is done here to switch interactions.
+            render_cancel(ctx);
+            render_wait(ctx);
+            if (count > 0) {
+                interactions[count - 1].tiles_cancelled = ctx->tiles_cancelled;
+            }
+            if (count == capacity) {
+                capacity *= 2;
+                interactions = realloc(interactions, sizeof(struct interaction_t) * capacity);
+            }
+            struct interaction_t blank = {start, 0, 0, 0};
+            interactions[count] = blank;
+
+            pthread_mutex_lock(&replay.lock);
+            replay.current = &interactions[count++];
+            pthread_mutex_unlock(&replay.lock);
+            render_submit(ctx, view.top, view.bottom);
+        }
+
+        more = read_event(file, &event) && event.type != SDL_QUIT;
+        if (more) {
+            // Sleep until the event is due, the render keeps going meanwhile.
+            double due = event.common.timestamp / 1000.0 - seconds_since(&replay.epoch);
+            if (due > 0) {
+                struct timespec pause = {(time_t) due, (long) ((due - (time_t) due) * 1e9)};
+                nanosleep(&pause, NULL);
+            }
+            dirty = view_event(&view, &event);
+        }
+    }
+    render_wait(ctx);
+    fclose(file);
+
+    // Collect the latencies. Interactions superseded before their frame was done count as dropped.
+    double *first_pixel = malloc(sizeof(double) * count);
+    double *complete = malloc(sizeof(double) * count);
+    unsigned int n_first = 0, n_complete = 0, dropped = 0, tiles_cancelled = 0;
+    for (unsigned int k = 0; k < count; k++) {
+        struct interaction_t *it = &interactions[k];
+        if (it->first_pixel > 0) {
+            first_pixel[n_first++] = it->first_pixel - it->start;
+        }
+        if (it->complete > 0) {
+            complete[n_complete++] = it->complete - it->start;
+        } else {
+            dropped++;
+        }
+        tiles_cancelled += it->tiles_cancelled;
+    }
+
+    printf("Replayed %u interactions: %u completed, %u dropped, %u tiles cancelled.\n",
+           count, n_complete, dropped, tiles_cancelled);
+    print_percentiles("time to first pixel", first_pixel, n_first);
+    print_percentiles("time to complete", complete, n_complete);
+
+    free(first_pixel);
+    free(complete);
+    free(interactions);
+    free_render_ctx(&ctx);
+    free_render_engine(&engine);
+    free_buffer(&buf);
+    pthread_mutex_destroy(&replay.lock);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,132 @@
+/* Moving the viewport around in response to user input */
+
+#include <complex.h>
+
+#include "viewport.h"
+
+void init_view(struct view_t *view) {
+    // This is the initial viewport. The viewport is like a window into the complex plane. It has
+    // a fixed shape but it is independant of the actual window (and window's surface) size. One
+    // major difference is that here the coordinate system is like in the complex plane (increasing y
+    // values go 'up') while the SDL coordinate system is different (increasing y go 'down').
+    view->top = CMPLXL(-2.5, 1.0);
+    view->bottom = CMPLXL(1.0, -1.0);
+    view->down_x = 0;
+    view->down_y = 0;
+}
+
+/*
+ * Applies a mouse or keyboard event to the view, returns 1 if the viewport changed. This prints
+ * nothing, as it also runs on the timed path of a headless replay.
+ */
+int view_event(struct view_t *view, const SDL_Event *event) {
+    switch (event->type) {
+        case SDL_MOUSEBUTTONDOWN:
+            view->down_x = event->button.x;
+            view->down_y = event->button.y;
+            return 0;
+        case SDL_MOUSEBUTTONUP:
+            change_viewport(view->down_x, view->down_y, event->button.x, event->button.y,
+                            &view->top, &view->bottom);
+            return 1;
+        case SDL_KEYDOWN:
+            switch (event->key.keysym.sym) {
+                /* move by sending specially chosen boundaries to change_viewport */
+                case SDLK_h:
+                case SDLK_LEFT:
+                    change_centre(0, WINDOW_HEIGHT/2, &view->top, &view->bottom);
+                    return 1;
+                case SDLK_l:
+                case SDLK_RIGHT:
+                    change_centre(WINDOW_WIDTH, WINDOW_HEIGHT/2, &view->top, &view->bottom);
+                    return 1;
+                case SDLK_k:
+                case SDLK_UP:
+                    change_centre(WINDOW_WIDTH/2, 0, &view->top, &view->bottom);
+                    return 1;
+                case SDLK_j:
+                case SDLK_DOWN:
+                    change_centre(WINDOW_WIDTH/2, WINDOW_HEIGHT, &view->top, &view->bottom);
+                    return 1;
+                case SDLK_SPACE: // zoom out
+                case SDLK_n:
+                    zoom(2.0, &view->top, &view->bottom);
+                    return 1;
+                case SDLK_RETURN: // zoom in
+                case SDLK_u:
+                    zoom(0.5, &view->top, &view->bottom);
+                    return 1;
+                default:
+                    return 0;
+            }
+        default:
+            return 0;
+    }
+}
+
+void change_viewport(int down_x, int down_y, int up_x, int up_y,
+                     ld_complex_t *viewport_top, ld_complex_t *viewport_bottom) {
+    int top_x = (down_x < up_x) ? down_x : up_x;
+    int top_y = (down_y < up_y) ? down_y : up_y;
+    int bottom_x = (down_x < up_x) ? up_x : down_x;
+    int bottom_y = (down_y < up_y) ? up_y : down_y;
+
+    int centre_x = (top_x + bottom_x) / 2;
+    int centre_y = (top_y + bottom_y) / 2;
+
+    float factor = (float) (bottom_x - top_x) / WINDOW_HEIGHT;
+    factor = (factor < 0.06) ? 0.06 : factor;
+
+    long double real_width = (creall(*viewport_bottom) - creall(*viewport_top));
+    long double imag_height = (cimagl(*viewport_bottom) - cimagl(*viewport_top));
+
+    long double real_offset = ((long double) centre_x / WINDOW_WIDTH)*real_width;
+    long double imag_offset = ((long double) centre_y / WINDOW_HEIGHT)*imag_height;
+
+    long double new_centre_real = real_offset + creall(*viewport_top);
+    long double new_centre_imag = imag_offset + cimagl(*viewport_top);
+
+    long double new_top_real = new_centre_real - factor*real_width/2;
+    long double new_top_imag = new_centre_imag - factor*imag_height/2;
+    long double new_bottom_real = new_centre_real + factor*real_width/2;
+    long double new_bottom_imag = new_centre_imag + factor*imag_height/2;
+
+    *viewport_top = CMPLXL(new_top_real, new_top_imag);
+    *viewport_bottom = CMPLXL(new_bottom_real, new_bottom_imag);
+}
+
+void change_centre(int centre_x, int centre_y, ld_complex_t *viewport_top, ld_complex_t *viewport_bottom) {
+    /* copy-paste from above ... I'm not proud */
+    long double real_width = (creall(*viewport_bottom) - creall(*viewport_top));
+    long double imag_height = (cimagl(*viewport_bottom) - cimagl(*viewport_top));
+
+    long double real_offset = ((long double) centre_x / WINDOW_WIDTH)*real_width;
+    long double imag_offset = ((long double) centre_y / WINDOW_HEIGHT)*imag_height;
+
+    long double new_centre_real = real_offset + creall(*viewport_top);
+    long double new_centre_imag = imag_offset + cimagl(*viewport_top);
+
+    long double new_top_real = new_centre_real - real_width/2;
+    long double new_top_imag = new_centre_imag - imag_height/2;
+    long double new_bottom_real = new_centre_real + real_width/2;
+    long double new_bottom_imag = new_centre_imag + imag_height/2;
+
+    *viewport_top = CMPLXL(new_top_real, new_top_imag);
+    *viewport_bottom = CMPLXL(new_bottom_real, new_bottom_imag);
+}
+
+void zoom(float factor, ld_complex_t *viewport_top, ld_complex_t *viewport_bottom) {
+    long double real_width = (creall(*viewport_bottom) - creall(*viewport_top));
+    long double imag_height = (cimagl(*viewport_bottom) - cimagl(*viewport_top));
+
+    long double centre_real = creall(*viewport_top) + real_width/2;
+    long double centre_imag = cimagl(*viewport_top) + imag_height/2;
+
+    long double new_top_real = centre_real - factor*real_width/2;
+    long double new_top_imag = centre_imag - factor*imag_height/2;
+    long double new_bottom_real = centre_real + factor*real_width/2;
+    long double new_bottom_imag = centre_imag + factor*imag_height/2;
+
+    *viewport_top = CMPLXL(new_top_real, new_top_imag);
+    *viewport_bottom = CMPLXL(new_bottom_real, new_bottom_imag);
+}